@@ -276,6 +276,22 @@ do_page_fault(unsigned long addr, unsigned int fsr, struct pt_regs *regs)
 	if (in_atomic() || !mm)
 		goto no_context;
 
+	/*
+	 * Most faults can be handled without mmap_sem: only if that
+	 * fails do we need to find and check the vma under it.  ARM
+	 * frees page tables without waiting for other cpus to flush
+	 * their TLBs, so this is only enabled on uniprocessor.
+	 */
+	fault = handle_speculative_fault(mm, addr,
+				(fsr & FSR_WRITE) ? FAULT_FLAG_WRITE : 0);
+	if (!(fault & VM_FAULT_RETRY)) {
+		if (fault & VM_FAULT_MAJOR)
+			tsk->maj_flt++;
+		else
+			tsk->min_flt++;
+		return 0;
+	}
+
 	/*
 	 * As per x86, we may deadlock here.  However, since the kernel only
 	 * validly references user space from well defined areas of the code,
@@ -396,6 +396,12 @@ HYPERVISOR_vcpu_op(int cmd, int vcpuid, void *extra_args)
 	return _hypercall3(int, vcpu_op, cmd, vcpuid, extra_args);
 }
 
+static inline int
+HYPERVISOR_tmem_op(void *op)
+{
+	return _hypercall1(int, tmem_op, op);
+}
+
 #ifdef CONFIG_X86_64
 static inline int
 HYPERVISOR_set_segment_base(int reg, unsigned long value)
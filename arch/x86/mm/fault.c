@@ -937,6 +937,23 @@ static int fault_in_kernel_space(unsigned long address)
 	return address >= TASK_SIZE_MAX;
 }
 
+static inline void
+account_fault(struct pt_regs *regs, unsigned long address,
+	      struct task_struct *tsk, int fault)
+{
+	if (fault & VM_FAULT_MAJOR) {
+		tsk->maj_flt++;
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1, 0,
+				     regs, address);
+	} else {
+		tsk->min_flt++;
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 0,
+				     regs, address);
+	}
+
+	check_v8086_mode(regs, address, tsk);
+}
+
 /*
  * This routine handles page faults.  It determines the address,
  * and the problem, and then passes it off to one of the appropriate
@@ -1039,6 +1056,19 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		return;
 	}
 
+	/*
+	 * Most faults can be handled without mmap_sem, so without waiting
+	 * behind mmap or munmap in other threads: only if that fails do we
+	 * need to find and check the vma under it.
+	 */
+	write = error_code & PF_WRITE;
+	fault = handle_speculative_fault(mm, address,
+					 write ? FAULT_FLAG_WRITE : 0);
+	if (!(fault & VM_FAULT_RETRY)) {
+		account_fault(regs, address, tsk, fault);
+		return;
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -1123,17 +1153,7 @@ good_area:
 		return;
 	}
 
-	if (fault & VM_FAULT_MAJOR) {
-		tsk->maj_flt++;
-		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1, 0,
-				     regs, address);
-	} else {
-		tsk->min_flt++;
-		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 0,
-				     regs, address);
-	}
-
-	check_v8086_mode(regs, address, tsk);
+	account_fault(regs, address, tsk, fault);
 
 	up_read(&mm->mmap_sem);
 }
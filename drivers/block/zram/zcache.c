@@ -0,0 +1,471 @@
+/*
+ * zcache - compressed cleancache backend
+ *
+ * Keeps the clean page cache pages that reclaim evicts compressed with
+ * LZO in a zobj pool, so that a later read of one costs a decompression
+ * rather than a disk read.  This is what a machine whose working set is
+ * a little larger than its RAM needs, typically a memory-tight guest.
+ *
+ * Pages are indexed per cleancache pool by inode, and per inode by page
+ * index.  Gets are exclusive: once a page is back in the page cache our
+ * copy is dropped, as the page cache will offer it again on eviction.
+ * Everything is kept on one LRU list, from which the oldest pages are
+ * dropped when the pool exceeds max_pool_percent of RAM or when the VM
+ * asks through our shrinker.
+ *
+ * Puts come from __remove_from_page_cache() with interrupts disabled
+ * and must not sleep, so all of zcache runs under a single irq-safe
+ * spinlock and allocates with GFP_NOWAIT.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zcache"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
+#include <linux/lzo.h>
+#include <linux/swap.h>
+#include <linux/cleancache.h>
+
+#include "zobj.h"
+
+#define ZCACHE_MAX_POOLS	32
+
+/* Pages that do not compress at least this well are not worth keeping */
+#define ZCACHE_MAX_CLEN		(PAGE_SIZE * 3 / 4)
+
+/* At most this many pages are dropped to make room for a new one */
+#define ZCACHE_EVICT_BATCH	8
+
+#define ZCACHE_GFP		(GFP_NOWAIT | __GFP_NORETRY | __GFP_NOWARN)
+
+struct zcache_pool {
+	struct rb_root inodes;
+};
+
+/* An inode with pages in zcache */
+struct zcache_inode {
+	struct rb_node node;		/* in its pool's tree */
+	struct zcache_pool *pool;
+	ino_t ino;
+	struct radix_tree_root pages;	/* zcache_pages by index */
+	struct list_head list;		/* of its zcache_pages */
+};
+
+/* A compressed page */
+struct zcache_page {
+	struct list_head lru;		/* on zcache_lru */
+	struct list_head list;		/* on its inode's list */
+	struct zcache_inode *zi;
+	pgoff_t index;
+	unsigned long handle;
+	size_t len;
+};
+
+static DEFINE_SPINLOCK(zcache_lock);
+static struct zcache_pool *zcache_pools[ZCACHE_MAX_POOLS];
+static LIST_HEAD(zcache_lru);
+static unsigned long zcache_nr_pages;
+
+static struct zobj_pool *zcache_mem_pool;
+static struct kmem_cache *zcache_inode_cache;
+static struct kmem_cache *zcache_page_cache;
+
+static DEFINE_PER_CPU(unsigned char *, zcache_dst);
+static DEFINE_PER_CPU(void *, zcache_workmem);
+
+/* Module params (documentation at end) */
+static unsigned int max_pool_percent = 10;
+
+static struct zcache_inode *zcache_find_inode(struct zcache_pool *pool,
+					      ino_t ino)
+{
+	struct rb_node *node = pool->inodes.rb_node;
+
+	while (node) {
+		struct zcache_inode *zi;
+
+		zi = rb_entry(node, struct zcache_inode, node);
+		if (ino < zi->ino)
+			node = node->rb_left;
+		else if (ino > zi->ino)
+			node = node->rb_right;
+		else
+			return zi;
+	}
+	return NULL;
+}
+
+static struct zcache_inode *zcache_get_inode(struct zcache_pool *pool,
+					     ino_t ino)
+{
+	struct rb_node **link = &pool->inodes.rb_node;
+	struct rb_node *parent = NULL;
+	struct zcache_inode *zi;
+
+	while (*link) {
+		parent = *link;
+		zi = rb_entry(parent, struct zcache_inode, node);
+		if (ino < zi->ino)
+			link = &parent->rb_left;
+		else if (ino > zi->ino)
+			link = &parent->rb_right;
+		else
+			return zi;
+	}
+
+	zi = kmem_cache_alloc(zcache_inode_cache, ZCACHE_GFP);
+	if (!zi)
+		return NULL;
+	zi->pool = pool;
+	zi->ino = ino;
+	INIT_RADIX_TREE(&zi->pages, ZCACHE_GFP);
+	INIT_LIST_HEAD(&zi->list);
+	rb_link_node(&zi->node, parent, link);
+	rb_insert_color(&zi->node, &pool->inodes);
+	return zi;
+}
+
+static void zcache_put_inode(struct zcache_inode *zi)
+{
+	if (list_empty(&zi->list)) {
+		rb_erase(&zi->node, &zi->pool->inodes);
+		kmem_cache_free(zcache_inode_cache, zi);
+	}
+}
+
+/* Drops a page, leaving its inode behind even if it is now empty */
+static void __zcache_free_page(struct zcache_page *zp)
+{
+	radix_tree_delete(&zp->zi->pages, zp->index);
+	list_del(&zp->list);
+	list_del(&zp->lru);
+	zobj_free(zcache_mem_pool, zp->handle);
+	kmem_cache_free(zcache_page_cache, zp);
+	zcache_nr_pages--;
+}
+
+static void zcache_free_page(struct zcache_page *zp)
+{
+	struct zcache_inode *zi = zp->zi;
+
+	__zcache_free_page(zp);
+	zcache_put_inode(zi);
+}
+
+static void zcache_free_inode(struct zcache_inode *zi)
+{
+	while (!list_empty(&zi->list))
+		__zcache_free_page(list_first_entry(&zi->list,
+					struct zcache_page, list));
+	zcache_put_inode(zi);
+}
+
+static struct zcache_page *zcache_lookup(struct zcache_pool *pool,
+					 ino_t ino, pgoff_t index)
+{
+	struct zcache_inode *zi = zcache_find_inode(pool, ino);
+
+	return zi ? radix_tree_lookup(&zi->pages, index) : NULL;
+}
+
+static bool zcache_over_limit(void)
+{
+	u64 size = zobj_get_total_size_bytes(zcache_mem_pool);
+
+	return (size >> PAGE_SHIFT) > totalram_pages * max_pool_percent / 100;
+}
+
+static void zcache_evict(unsigned long nr)
+{
+	while (nr-- && !list_empty(&zcache_lru))
+		zcache_free_page(list_entry(zcache_lru.prev,
+					    struct zcache_page, lru));
+}
+
+static void zcache_put_page(int pool_id, ino_t ino, pgoff_t index,
+			    struct page *page)
+{
+	struct zcache_pool *pool;
+	struct zcache_inode *zi;
+	struct zcache_page *zp;
+	unsigned long flags, handle;
+	unsigned char *src, *dst;
+	size_t clen;
+	int ret, nr;
+
+	/* The per-cpu buffers are ours as long as interrupts are off */
+	local_irq_save(flags);
+	dst = __get_cpu_var(zcache_dst);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &clen,
+			       __get_cpu_var(zcache_workmem));
+	kunmap_atomic(src, KM_USER0);
+
+	spin_lock(&zcache_lock);
+	pool = zcache_pools[pool_id];
+	if (!pool)
+		goto out;
+
+	/* Whatever happens, an older copy of the page is stale now */
+	zp = zcache_lookup(pool, ino, index);
+	if (zp)
+		zcache_free_page(zp);
+
+	if (unlikely(ret != LZO_E_OK) || clen > ZCACHE_MAX_CLEN)
+		goto out;
+
+	for (nr = 0; zcache_over_limit(); nr++) {
+		if (nr == ZCACHE_EVICT_BATCH || list_empty(&zcache_lru))
+			goto out;
+		zcache_evict(1);
+	}
+
+	handle = zobj_malloc(zcache_mem_pool, clen);
+	if (!handle)
+		goto out;
+	zp = kmem_cache_alloc(zcache_page_cache, ZCACHE_GFP);
+	if (!zp)
+		goto out_free_handle;
+	zi = zcache_get_inode(pool, ino);
+	if (!zi)
+		goto out_free_zp;
+	if (radix_tree_insert(&zi->pages, index, zp)) {
+		zcache_put_inode(zi);
+		goto out_free_zp;
+	}
+
+	zobj_write(zcache_mem_pool, handle, dst, clen);
+	zp->zi = zi;
+	zp->index = index;
+	zp->handle = handle;
+	zp->len = clen;
+	list_add(&zp->list, &zi->list);
+	list_add(&zp->lru, &zcache_lru);
+	zcache_nr_pages++;
+	goto out;
+
+out_free_zp:
+	kmem_cache_free(zcache_page_cache, zp);
+out_free_handle:
+	zobj_free(zcache_mem_pool, handle);
+out:
+	spin_unlock(&zcache_lock);
+	local_irq_restore(flags);
+}
+
+static int zcache_get_page(int pool_id, ino_t ino, pgoff_t index,
+			   struct page *page)
+{
+	struct zcache_pool *pool;
+	struct zcache_page *zp;
+	unsigned char *src, *dst;
+	unsigned long flags;
+	size_t dlen = PAGE_SIZE;
+	int ret = -1;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pools[pool_id];
+	zp = pool ? zcache_lookup(pool, ino, index) : NULL;
+	if (zp) {
+		src = zobj_map(zcache_mem_pool, zp->handle);
+		dst = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_decompress_safe(src, zp->len, dst, &dlen);
+		kunmap_atomic(dst, KM_USER0);
+		zobj_unmap(zcache_mem_pool, zp->handle);
+		zcache_free_page(zp);
+
+		if (unlikely(ret != LZO_E_OK || dlen != PAGE_SIZE)) {
+			pr_err("Decompression failed! err=%d, ino=%lu, "
+			       "index=%lu\n", ret, (unsigned long)ino, index);
+			ret = -1;
+		}
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	return ret;
+}
+
+static void zcache_flush_page(int pool_id, ino_t ino, pgoff_t index)
+{
+	struct zcache_pool *pool;
+	struct zcache_page *zp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pools[pool_id];
+	zp = pool ? zcache_lookup(pool, ino, index) : NULL;
+	if (zp)
+		zcache_free_page(zp);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static void zcache_flush_inode(int pool_id, ino_t ino)
+{
+	struct zcache_pool *pool;
+	struct zcache_inode *zi;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pools[pool_id];
+	zi = pool ? zcache_find_inode(pool, ino) : NULL;
+	if (zi)
+		zcache_free_inode(zi);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static void zcache_flush_fs(int pool_id)
+{
+	struct zcache_pool *pool;
+	struct rb_node *node;
+
+	spin_lock_irq(&zcache_lock);
+	pool = zcache_pools[pool_id];
+	zcache_pools[pool_id] = NULL;
+	if (!pool)
+		goto out;
+
+	/*
+	 * Nobody can find the pool anymore, but eviction may still free its
+	 * pages, so the tree is only walked under the lock; it is dropped
+	 * between inodes as a big filesystem can have lots of pages here.
+	 */
+	while ((node = rb_first(&pool->inodes))) {
+		zcache_free_inode(rb_entry(node, struct zcache_inode, node));
+		if (need_resched()) {
+			spin_unlock_irq(&zcache_lock);
+			cond_resched();
+			spin_lock_irq(&zcache_lock);
+		}
+	}
+	kfree(pool);
+out:
+	spin_unlock_irq(&zcache_lock);
+}
+
+static int zcache_init_fs(size_t pagesize)
+{
+	struct zcache_pool *pool;
+	int pool_id;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return -1;
+	pool->inodes = RB_ROOT;
+
+	spin_lock_irq(&zcache_lock);
+	for (pool_id = 0; pool_id < ZCACHE_MAX_POOLS; pool_id++) {
+		if (!zcache_pools[pool_id]) {
+			zcache_pools[pool_id] = pool;
+			break;
+		}
+	}
+	spin_unlock_irq(&zcache_lock);
+
+	if (pool_id == ZCACHE_MAX_POOLS) {
+		pr_info("Out of pools\n");
+		kfree(pool);
+		return -1;
+	}
+	return pool_id;
+}
+
+static struct cleancache_ops zcache_ops = {
+	.init_fs	= zcache_init_fs,
+	.get_page	= zcache_get_page,
+	.put_page	= zcache_put_page,
+	.flush_page	= zcache_flush_page,
+	.flush_inode	= zcache_flush_inode,
+	.flush_fs	= zcache_flush_fs,
+};
+
+static int zcache_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		spin_lock_irq(&zcache_lock);
+		zcache_evict(nr_to_scan);
+		spin_unlock_irq(&zcache_lock);
+	}
+	return zcache_nr_pages;
+}
+
+static struct shrinker zcache_shrinker = {
+	.shrink	= zcache_shrink,
+	.seeks	= DEFAULT_SEEKS,
+};
+
+static void zcache_free_buffers(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		free_pages((unsigned long)per_cpu(zcache_dst, cpu), 1);
+		kfree(per_cpu(zcache_workmem, cpu));
+	}
+}
+
+static int __init zcache_init(void)
+{
+	int cpu, ret = -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		/* lzo1x_1_compress() may expand incompressible data */
+		per_cpu(zcache_dst, cpu) =
+			(void *)__get_free_pages(GFP_KERNEL, 1);
+		per_cpu(zcache_workmem, cpu) =
+			kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		if (!per_cpu(zcache_dst, cpu) || !per_cpu(zcache_workmem, cpu))
+			goto out;
+	}
+
+	zcache_inode_cache = KMEM_CACHE(zcache_inode, 0);
+	zcache_page_cache = KMEM_CACHE(zcache_page, 0);
+	if (!zcache_inode_cache || !zcache_page_cache)
+		goto out_caches;
+
+	zcache_mem_pool = zobj_create_pool(ZCACHE_GFP);
+	if (!zcache_mem_pool)
+		goto out_caches;
+
+	ret = cleancache_register_ops(&zcache_ops);
+	if (ret) {
+		pr_info("Another cleancache backend is registered\n");
+		goto out_pool;
+	}
+	register_shrinker(&zcache_shrinker);
+
+	pr_info("Enabled, using up to %u%% of RAM\n", max_pool_percent);
+	return 0;
+
+out_pool:
+	zobj_destroy_pool(zcache_mem_pool);
+out_caches:
+	if (zcache_page_cache)
+		kmem_cache_destroy(zcache_page_cache);
+	if (zcache_inode_cache)
+		kmem_cache_destroy(zcache_inode_cache);
+out:
+	zcache_free_buffers();
+	return ret;
+}
+
+module_param(max_pool_percent, uint, 0644);
+MODULE_PARM_DESC(max_pool_percent,
+		 "Maximum percentage of RAM the compressed pages may use");
+
+module_init(zcache_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cleancache backend");
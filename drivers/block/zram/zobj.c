@@ -0,0 +1,402 @@
+/*
+ * zobj - allocator for compressed objects
+ *
+ * Compressed pages come in all sizes up to PAGE_SIZE, which kmalloc()
+ * would round up to the next power of two, wasting a quarter of the
+ * memory on average.  zobj has a size class every ZOBJ_ALIGN bytes
+ * instead and packs the objects of a class back to back into "zspages"
+ * of up to ZOBJ_MAX_PAGES order-0 pages, so an object may straddle two
+ * pages.  The number of pages of a zspage is chosen per class so as to
+ * waste as little as possible at its end, and a zspage is given back as
+ * soon as its last object is freed.
+ *
+ * Objects are referred to by an opaque handle encoding the first page of
+ * their zspage and their index in it.  They are written with
+ * zobj_write() and read through zobj_map(), which copies objects that
+ * straddle two pages into a per-cpu buffer.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+
+#include "zobj.h"
+
+#define ZOBJ_ALIGN_SHIFT	(PAGE_SHIFT - 8)
+#define ZOBJ_ALIGN		(1 << ZOBJ_ALIGN_SHIFT)
+#define ZOBJ_MIN_SIZE		(2 * ZOBJ_ALIGN)
+#define ZOBJ_MAX_SIZE		PAGE_SIZE
+#define ZOBJ_NR_CLASSES		((ZOBJ_MAX_SIZE - ZOBJ_MIN_SIZE) / ZOBJ_ALIGN + 1)
+
+#define ZOBJ_MAX_PAGES		4
+
+/*
+ * A handle is the pfn of the first page of the zspage, followed by the
+ * object index plus one (so that no handle is 0).  A zspage holds at most
+ * ZOBJ_MAX_PAGES * PAGE_SIZE / ZOBJ_MIN_SIZE = 512 objects.
+ */
+#define ZOBJ_IDX_BITS		10
+#define ZOBJ_IDX_MASK		((1UL << ZOBJ_IDX_BITS) - 1)
+
+struct zspage {
+	struct list_head list;		/* on the partial list of its class */
+	unsigned int inuse;		/* number of allocated objects */
+	unsigned int freelist;		/* index of the first free object */
+	unsigned int class;
+	struct page *pages[ZOBJ_MAX_PAGES];
+};
+
+struct size_class {
+	spinlock_t lock;
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head partial;	/* zspages with free objects */
+};
+
+struct zobj_pool {
+	struct size_class classes[ZOBJ_NR_CLASSES];
+	atomic_t pages_allocated;
+	gfp_t flags;
+	void **map_buf;			/* per-cpu, see zobj_map() */
+};
+
+static unsigned int get_size_class_index(size_t size)
+{
+	if (size <= ZOBJ_MIN_SIZE)
+		return 0;
+	return DIV_ROUND_UP(size - ZOBJ_MIN_SIZE, ZOBJ_ALIGN);
+}
+
+/*
+ * Pick the zspage size, in pages, that leaves the least unused space
+ * after the last object of a class.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_used = 0;
+
+	for (i = 1; i <= ZOBJ_MAX_PAGES; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int used;
+
+		used = (zspage_size - zspage_size % size) * 100 / zspage_size;
+		if (used > best_used) {
+			best_used = used;
+			best = i;
+		}
+	}
+	return best;
+}
+
+static void obj_location(struct size_class *class, unsigned int idx,
+			 unsigned int *pg, unsigned int *off)
+{
+	unsigned long offset = (unsigned long)idx * class->size;
+
+	*pg = offset >> PAGE_SHIFT;
+	*off = offset & ~PAGE_MASK;
+}
+
+/*
+ * Free objects hold the index of the next free one in their first word,
+ * which never straddles a page: objects are ZOBJ_ALIGN aligned.
+ */
+static unsigned int *obj_link(struct zspage *zspage, struct size_class *class,
+			      unsigned int idx)
+{
+	unsigned int pg, off;
+
+	obj_location(class, idx, &pg, &off);
+	return page_address(zspage->pages[pg]) + off;
+}
+
+static unsigned long encode_handle(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << ZOBJ_IDX_BITS) | (idx + 1);
+}
+
+static struct zspage *decode_handle(unsigned long handle, unsigned int *idx)
+{
+	*idx = (handle & ZOBJ_IDX_MASK) - 1;
+	return (struct zspage *)page_private(pfn_to_page(handle >> ZOBJ_IDX_BITS));
+}
+
+static void free_zspage(struct zobj_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+	atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+static struct zspage *alloc_zspage(struct zobj_pool *pool, unsigned int class_idx)
+{
+	struct size_class *class = &pool->classes[class_idx];
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kmalloc(sizeof(*zspage), pool->flags);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(pool->flags);
+
+		if (!page) {
+			while (i--) {
+				set_page_private(zspage->pages[i], 0);
+				__free_page(zspage->pages[i]);
+			}
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->inuse = 0;
+	zspage->freelist = 0;
+	zspage->class = class_idx;
+	for (i = 0; i < class->objs_per_zspage; i++)
+		*obj_link(zspage, class, i) = i + 1;
+
+	atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+}
+
+/**
+ * zobj_malloc - allocate an object
+ * @pool: pool to allocate from
+ * @size: size of the object, at most PAGE_SIZE
+ *
+ * Returns the handle of the object, 0 on failure.  May sleep if the
+ * pool allows it.
+ */
+unsigned long zobj_malloc(struct zobj_pool *pool, size_t size)
+{
+	unsigned int class_idx, idx;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZOBJ_MAX_SIZE))
+		return 0;
+
+	class_idx = get_size_class_index(size);
+	class = &pool->classes[class_idx];
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class_idx);
+		if (!zspage)
+			return 0;
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	idx = zspage->freelist;
+	zspage->freelist = *obj_link(zspage, class, idx);
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_del_init(&zspage->list);
+	spin_unlock(&class->lock);
+
+	return encode_handle(zspage, idx);
+}
+EXPORT_SYMBOL_GPL(zobj_malloc);
+
+/**
+ * zobj_free - free an object
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zobj_malloc()
+ *
+ * Does not sleep.
+ */
+void zobj_free(struct zobj_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!handle))
+		return;
+
+	zspage = decode_handle(handle, &idx);
+	class = &pool->classes[zspage->class];
+
+	spin_lock(&class->lock);
+	*obj_link(zspage, class, idx) = zspage->freelist;
+	zspage->freelist = idx;
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_add(&zspage->list, &class->partial);
+
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		spin_unlock(&class->lock);
+		free_zspage(pool, class, zspage);
+		return;
+	}
+	spin_unlock(&class->lock);
+}
+EXPORT_SYMBOL_GPL(zobj_free);
+
+/**
+ * zobj_write - copy data into an object
+ * @pool: pool of the object
+ * @handle: handle of the object
+ * @src: data to copy
+ * @len: length of the data, at most the size the object was allocated with
+ */
+void zobj_write(struct zobj_pool *pool, unsigned long handle,
+		const void *src, size_t len)
+{
+	struct zspage *zspage;
+	unsigned int idx, pg, off;
+	size_t first;
+
+	zspage = decode_handle(handle, &idx);
+	obj_location(&pool->classes[zspage->class], idx, &pg, &off);
+
+	first = min_t(size_t, len, PAGE_SIZE - off);
+	memcpy(page_address(zspage->pages[pg]) + off, src, first);
+	if (len > first)
+		memcpy(page_address(zspage->pages[pg + 1]), src + first,
+		       len - first);
+}
+EXPORT_SYMBOL_GPL(zobj_write);
+
+/**
+ * zobj_map - get at the contents of an object
+ * @pool: pool of the object
+ * @handle: handle of the object
+ *
+ * Returns a pointer to the object, valid until zobj_unmap().  The object
+ * must not be written or freed in between.  Disables preemption.
+ */
+void *zobj_map(struct zobj_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx, pg, off, first;
+	void *buf;
+
+	buf = *per_cpu_ptr(pool->map_buf, get_cpu());
+
+	zspage = decode_handle(handle, &idx);
+	class = &pool->classes[zspage->class];
+	obj_location(class, idx, &pg, &off);
+
+	if (off + class->size <= PAGE_SIZE)
+		return page_address(zspage->pages[pg]) + off;
+
+	first = PAGE_SIZE - off;
+	memcpy(buf, page_address(zspage->pages[pg]) + off, first);
+	memcpy(buf + first, page_address(zspage->pages[pg + 1]),
+	       class->size - first);
+	return buf;
+}
+EXPORT_SYMBOL_GPL(zobj_map);
+
+void zobj_unmap(struct zobj_pool *pool, unsigned long handle)
+{
+	put_cpu();
+}
+EXPORT_SYMBOL_GPL(zobj_unmap);
+
+/**
+ * zobj_get_total_size_bytes - memory used by a pool
+ * @pool: the pool
+ *
+ * Returns the size of all the pages currently backing objects.
+ */
+u64 zobj_get_total_size_bytes(struct zobj_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zobj_get_total_size_bytes);
+
+/**
+ * zobj_create_pool - create an object pool
+ * @flags: allocation flags for the pool's pages
+ *
+ * Pages are always allocated from lowmem, __GFP_HIGHMEM is ignored.
+ */
+struct zobj_pool *zobj_create_pool(gfp_t flags)
+{
+	struct zobj_pool *pool;
+	unsigned int i;
+	int cpu;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZOBJ_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		class->size = ZOBJ_MIN_SIZE + i * ZOBJ_ALIGN;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					 class->size;
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+	}
+
+	atomic_set(&pool->pages_allocated, 0);
+	pool->flags = flags & ~__GFP_HIGHMEM;
+
+	pool->map_buf = alloc_percpu(void *);
+	if (!pool->map_buf)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		void *buf = (void *)__get_free_page(GFP_KERNEL);
+
+		if (!buf)
+			goto fail;
+		*per_cpu_ptr(pool->map_buf, cpu) = buf;
+	}
+
+	return pool;
+
+fail:
+	zobj_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zobj_create_pool);
+
+/**
+ * zobj_destroy_pool - destroy an object pool
+ * @pool: the pool, all of whose objects must have been freed
+ */
+void zobj_destroy_pool(struct zobj_pool *pool)
+{
+	int cpu;
+
+	WARN_ON(atomic_read(&pool->pages_allocated));
+
+	if (pool->map_buf) {
+		for_each_possible_cpu(cpu)
+			free_page((unsigned long)*per_cpu_ptr(pool->map_buf, cpu));
+		free_percpu(pool->map_buf);
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zobj_destroy_pool);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Allocator for compressed objects");
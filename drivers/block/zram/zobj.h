@@ -0,0 +1,27 @@
+/*
+ * zobj - allocator for compressed objects
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZOBJ_H_
+#define _ZOBJ_H_
+
+#include <linux/types.h>
+
+struct zobj_pool;
+
+struct zobj_pool *zobj_create_pool(gfp_t flags);
+void zobj_destroy_pool(struct zobj_pool *pool);
+
+unsigned long zobj_malloc(struct zobj_pool *pool, size_t size);
+void zobj_free(struct zobj_pool *pool, unsigned long handle);
+
+void zobj_write(struct zobj_pool *pool, unsigned long handle,
+		const void *src, size_t len);
+void *zobj_map(struct zobj_pool *pool, unsigned long handle);
+void zobj_unmap(struct zobj_pool *pool, unsigned long handle);
+
+u64 zobj_get_total_size_bytes(struct zobj_pool *pool);
+
+#endif
@@ -0,0 +1,772 @@
+/*
+ * Compressed RAM block device
+ *
+ * Creates /dev/zramX block devices whose pages are compressed with LZO
+ * and kept in memory.  Used as a swap device it trades some CPU for
+ * keeping much more anonymous memory around than would otherwise fit,
+ * which is usually a good deal on machines without (or with very slow)
+ * backing storage.
+ *
+ * Only page-sized, page-aligned I/O is supported.  The swap code tells
+ * us through ->swap_slot_free_notify() when a slot is no longer used so
+ * that its memory is released right away rather than on the next write
+ * of the slot; discard requests do the same for other users.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/string.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Globals */
+static int zram_major;
+static struct zram *devices;
+
+/* Module params (documentation at end) */
+static unsigned int num_devices;
+
+static void zram_stat_add(struct zram *zram, u64 *v, s64 delta)
+{
+	spin_lock(&zram->stat_lock);
+	*v += delta;
+	spin_unlock(&zram->stat_lock);
+}
+
+static u64 zram_stat_read(struct zram *zram, u64 *v)
+{
+	u64 val;
+
+	spin_lock(&zram->stat_lock);
+	val = *v;
+	spin_unlock(&zram->stat_lock);
+
+	return val;
+}
+
+static void zram_stat_inc(struct zram *zram, u64 *v)
+{
+	zram_stat_add(zram, v, 1);
+}
+
+static void zram_stat_dec(struct zram *zram, u64 *v)
+{
+	zram_stat_add(zram, v, -1);
+}
+
+static int zram_test_flag(struct zram *zram, u32 index,
+			  enum zram_pageflags flag)
+{
+	return zram->table[index].flags & (1 << flag);
+}
+
+static void zram_set_flag(struct zram *zram, u32 index,
+			  enum zram_pageflags flag)
+{
+	zram->table[index].flags |= (1 << flag);
+}
+
+static void zram_clear_flag(struct zram *zram, u32 index,
+			    enum zram_pageflags flag)
+{
+	zram->table[index].flags &= ~(1 << flag);
+}
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+static u64 zram_default_disksize(void)
+{
+	return ((u64)totalram_pages * default_disksize_perc_ram / 100)
+		<< PAGE_SHIFT;
+}
+
+/* Called with table_lock held for writing */
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct table *t = &zram->table[index];
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_clear_flag(zram, index, ZRAM_ZERO);
+		zram_stat_dec(zram, &zram->stats.pages_zero);
+		return;
+	}
+
+	if (!t->handle)
+		return;
+
+	if (t->size == PAGE_SIZE)
+		zram_stat_dec(zram, &zram->stats.pages_expand);
+	else if (t->size <= PAGE_SIZE / 2)
+		zram_stat_dec(zram, &zram->stats.good_compress);
+
+	zram_stat_add(zram, &zram->stats.compr_size, -(s64)t->size);
+	zram_stat_dec(zram, &zram->stats.pages_stored);
+
+	zobj_free(zram->mem_pool, t->handle);
+	t->handle = 0;
+	t->size = 0;
+}
+
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	struct table *t;
+	unsigned char *user_mem, *cmem;
+	size_t clen = PAGE_SIZE;
+	int ret = LZO_E_OK;
+
+	read_lock(&zram->table_lock);
+	t = &zram->table[index];
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	/* Zero filled or never written */
+	if (!t->handle) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		cmem = zobj_map(zram->mem_pool, t->handle);
+		if (t->size == PAGE_SIZE)
+			memcpy(user_mem, cmem, PAGE_SIZE);
+		else
+			ret = lzo1x_decompress_safe(cmem, t->size,
+						    user_mem, &clen);
+		zobj_unmap(zram->mem_pool, t->handle);
+	}
+
+	kunmap_atomic(user_mem, KM_USER0);
+	read_unlock(&zram->table_lock);
+	flush_dcache_page(page);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	unsigned char *user_mem;
+	unsigned long handle;
+	size_t clen;
+	int ret;
+
+	mutex_lock(&zram->lock);
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		write_lock(&zram->table_lock);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->table_lock);
+		mutex_unlock(&zram->lock);
+		zram_stat_inc(zram, &zram->stats.pages_zero);
+		return 0;
+	}
+
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, zram->compress_buffer,
+			       &clen, zram->compress_workmem);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret != LZO_E_OK)) {
+		mutex_unlock(&zram->lock);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
+
+	/* Not worth decompressing, store the page as is */
+	if (unlikely(clen > max_zpage_size))
+		clen = PAGE_SIZE;
+
+	handle = zobj_malloc(zram->mem_pool, clen);
+	if (unlikely(!handle)) {
+		mutex_unlock(&zram->lock);
+		pr_info("Error allocating memory for compressed page: %u, size=%zu\n",
+			index, clen);
+		return -ENOMEM;
+	}
+
+	if (clen == PAGE_SIZE) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		zobj_write(zram->mem_pool, handle, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+	} else {
+		zobj_write(zram->mem_pool, handle, zram->compress_buffer, clen);
+	}
+
+	write_lock(&zram->table_lock);
+	zram_free_page(zram, index);
+	zram->table[index].handle = handle;
+	zram->table[index].size = clen;
+	write_unlock(&zram->table_lock);
+
+	mutex_unlock(&zram->lock);
+
+	if (clen == PAGE_SIZE)
+		zram_stat_inc(zram, &zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(zram, &zram->stats.good_compress);
+	zram_stat_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(zram, &zram->stats.pages_stored);
+
+	return 0;
+}
+
+/*
+ * Discard requests may cover partial pages at either end: only pages
+ * entirely within the range are released.
+ */
+static void zram_discard(struct zram *zram, struct bio *bio)
+{
+	sector_t end = bio->bi_sector + bio_sectors(bio);
+	size_t index = DIV_ROUND_UP(bio->bi_sector, SECTORS_PER_PAGE);
+	size_t last = end >> SECTORS_PER_PAGE_SHIFT;
+
+	write_lock(&zram->table_lock);
+	for (; index < last; index++)
+		zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
+}
+
+/*
+ * Check if request is within bounds and page aligned.
+ */
+static inline int valid_io_request(struct zram *zram, struct bio *bio)
+{
+	if (unlikely(
+		(bio->bi_sector >= (zram->disksize >> SECTOR_SHIFT)) ||
+		(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
+		(bio->bi_size & (PAGE_SIZE - 1)))) {
+
+		return 0;
+	}
+
+	/* I/O request is valid */
+	return 1;
+}
+
+static void __zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	zram->init_done = 0;
+
+	/* Free various per-device buffers */
+	kfree(zram->compress_workmem);
+	free_pages((unsigned long)zram->compress_buffer, 1);
+
+	zram->compress_workmem = NULL;
+	zram->compress_buffer = NULL;
+
+	/* Free all pages that are still in this zram device */
+	if (zram->table) {
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+			unsigned long handle = zram->table[index].handle;
+
+			if (handle)
+				zobj_free(zram->mem_pool, handle);
+		}
+		vfree(zram->table);
+		zram->table = NULL;
+	}
+
+	if (zram->mem_pool) {
+		zobj_destroy_pool(zram->mem_pool);
+		zram->mem_pool = NULL;
+	}
+
+	/* Reset stats */
+	memset(&zram->stats, 0, sizeof(zram->stats));
+}
+
+static void zram_reset_device(struct zram *zram)
+{
+	mutex_lock(&zram->init_lock);
+	__zram_reset_device(zram);
+	mutex_unlock(&zram->init_lock);
+}
+
+/*
+ * Memory is only allocated on first use, so that the disk size can still
+ * be set through sysfs after the module is loaded.
+ */
+static int zram_init_device(struct zram *zram)
+{
+	int ret;
+	size_t num_pages;
+
+	mutex_lock(&zram->init_lock);
+
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return 0;
+	}
+
+	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	if (!zram->compress_workmem) {
+		pr_err("Error allocating compressor working memory!\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	/* lzo1x_1_compress() may expand incompressible data */
+	zram->compress_buffer =
+		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zram->compress_buffer) {
+		pr_err("Error allocating compressor buffer space\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	zram->table = vmalloc(num_pages * sizeof(*zram->table));
+	if (!zram->table) {
+		pr_err("Error allocating zram address table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(zram->table, 0, num_pages * sizeof(*zram->table));
+
+	zram->mem_pool = zobj_create_pool(GFP_NOIO | __GFP_NOWARN);
+	if (!zram->mem_pool) {
+		pr_err("Error creating memory pool\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	zram->init_done = 1;
+	mutex_unlock(&zram->init_lock);
+
+	pr_debug("Initialization done!\n");
+	return 0;
+
+fail:
+	__zram_reset_device(zram);
+	mutex_unlock(&zram->init_lock);
+	pr_err("Initialization failed: err=%d\n", ret);
+	return ret;
+}
+
+static int zram_make_request(struct request_queue *queue, struct bio *bio)
+{
+	struct zram *zram = queue->queuedata;
+	struct bio_vec *bvec;
+	u32 index;
+	int i, ret = 0;
+
+	if (unlikely(!zram->init_done) && zram_init_device(zram)) {
+		bio_io_error(bio);
+		return 0;
+	}
+
+	if (!valid_io_request(zram, bio)) {
+		zram_stat_inc(zram, &zram->stats.invalid_io);
+		bio_io_error(bio);
+		return 0;
+	}
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_DISCARD))) {
+		zram_discard(zram, bio);
+		bio_endio(bio, 0);
+		return 0;
+	}
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (unlikely(bvec->bv_len != PAGE_SIZE || bvec->bv_offset)) {
+			zram_stat_inc(zram, &zram->stats.invalid_io);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (bio_data_dir(bio) == READ) {
+			zram_stat_inc(zram, &zram->stats.num_reads);
+			ret = zram_read_page(zram, bvec->bv_page, index);
+			if (ret)
+				zram_stat_inc(zram, &zram->stats.failed_reads);
+		} else {
+			zram_stat_inc(zram, &zram->stats.num_writes);
+			ret = zram_write_page(zram, bvec->bv_page, index);
+			if (ret)
+				zram_stat_inc(zram, &zram->stats.failed_writes);
+		}
+		if (ret)
+			break;
+
+		index++;
+	}
+
+	bio_endio(bio, ret);
+	return 0;
+}
+
+static void zram_slot_free_notify(struct block_device *bdev,
+				  unsigned long index)
+{
+	struct zram *zram = bdev->bd_disk->private_data;
+
+	write_lock(&zram->table_lock);
+	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
+	zram_stat_inc(zram, &zram->stats.notify_free);
+}
+
+static struct block_device_operations zram_devops = {
+	.swap_slot_free_notify	= zram_slot_free_notify,
+	.owner			= THIS_MODULE,
+};
+
+/*
+ * sysfs interface, under /sys/block/zramX/
+ */
+static inline struct zram *dev_to_zram(struct device *dev)
+{
+	return (struct zram *)dev_to_disk(dev)->private_data;
+}
+
+static ssize_t disksize_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n", zram->disksize);
+}
+
+static ssize_t disksize_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 disksize;
+
+	disksize = memparse(buf, NULL);
+	disksize = PAGE_ALIGN(disksize);
+	if (!disksize)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change disksize for initialized device\n");
+		return -EBUSY;
+	}
+
+	zram->disksize = disksize;
+	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t initstate_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->init_done);
+}
+
+static ssize_t reset_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct block_device *bdev;
+	unsigned long do_reset;
+	int ret;
+
+	ret = strict_strtoul(buf, 10, &do_reset);
+	if (ret)
+		return ret;
+	if (!do_reset)
+		return -EINVAL;
+
+	bdev = bdget_disk(zram->disk, 0);
+	if (!bdev)
+		return -ENOMEM;
+
+	/* Do not reset an active device, e.g. one used as swap */
+	if (bdev->bd_holders) {
+		bdput(bdev);
+		return -EBUSY;
+	}
+
+	if (zram->init_done) {
+		fsync_bdev(bdev);
+		zram_reset_device(zram);
+	}
+	bdput(bdev);
+
+	return len;
+}
+
+#define ZRAM_STAT_ATTR(name)						\
+static ssize_t name##_show(struct device *dev,				\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct zram *zram = dev_to_zram(dev);				\
+									\
+	return sprintf(buf, "%llu\n",					\
+		zram_stat_read(zram, &zram->stats.name));		\
+}									\
+static DEVICE_ATTR(name, S_IRUGO, name##_show, NULL)
+
+ZRAM_STAT_ATTR(num_reads);
+ZRAM_STAT_ATTR(num_writes);
+ZRAM_STAT_ATTR(failed_reads);
+ZRAM_STAT_ATTR(failed_writes);
+ZRAM_STAT_ATTR(invalid_io);
+ZRAM_STAT_ATTR(notify_free);
+ZRAM_STAT_ATTR(pages_zero);
+ZRAM_STAT_ATTR(good_compress);
+ZRAM_STAT_ATTR(pages_expand);
+
+static ssize_t orig_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat_read(zram, &zram->stats.pages_stored) << PAGE_SHIFT);
+}
+
+static ssize_t compr_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat_read(zram, &zram->stats.compr_size));
+}
+
+/* Includes allocator fragmentation and metadata overhead */
+static ssize_t mem_used_total_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 val = 0;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		val = zobj_get_total_size_bytes(zram->mem_pool) +
+		      ((zram->disksize >> PAGE_SHIFT) * sizeof(*zram->table));
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+/* Ratio of stored to compressed data, with two decimals */
+static ssize_t compr_ratio_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 orig, compr, ratio = 0;
+
+	orig = zram_stat_read(zram, &zram->stats.pages_stored) << PAGE_SHIFT;
+	compr = zram_stat_read(zram, &zram->stats.compr_size);
+	if (compr)
+		ratio = div64_u64(orig * 100, compr);
+
+	return sprintf(buf, "%llu.%02llu\n", ratio / 100, ratio % 100);
+}
+
+static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
+		disksize_show, disksize_store);
+static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
+static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
+static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
+static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
+static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compr_ratio, S_IRUGO, compr_ratio_show, NULL);
+
+static struct attribute *zram_disk_attrs[] = {
+	&dev_attr_disksize.attr,
+	&dev_attr_initstate.attr,
+	&dev_attr_reset.attr,
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_reads.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_invalid_io.attr,
+	&dev_attr_notify_free.attr,
+	&dev_attr_pages_zero.attr,
+	&dev_attr_good_compress.attr,
+	&dev_attr_pages_expand.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	&dev_attr_compr_ratio.attr,
+	NULL,
+};
+
+static struct attribute_group zram_disk_attr_group = {
+	.attrs = zram_disk_attrs,
+};
+
+static int create_device(struct zram *zram, int device_id)
+{
+	int ret;
+
+	mutex_init(&zram->lock);
+	mutex_init(&zram->init_lock);
+	rwlock_init(&zram->table_lock);
+	spin_lock_init(&zram->stat_lock);
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue) {
+		pr_err("Error allocating disk queue for device %d\n",
+			device_id);
+		return -ENOMEM;
+	}
+
+	blk_queue_make_request(zram->queue, zram_make_request);
+	zram->queue->queuedata = zram;
+
+	 /* gendisk structure */
+	zram->disk = alloc_disk(1);
+	if (!zram->disk) {
+		blk_cleanup_queue(zram->queue);
+		pr_warning("Error allocating disk structure for device %d\n",
+			device_id);
+		return -ENOMEM;
+	}
+
+	zram->disk->major = zram_major;
+	zram->disk->first_minor = device_id;
+	zram->disk->fops = &zram_devops;
+	zram->disk->queue = zram->queue;
+	zram->disk->private_data = zram;
+	snprintf(zram->disk->disk_name, 16, "zram%d", device_id);
+
+	zram->disksize = zram_default_disksize();
+	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
+
+	/*
+	 * To ensure that we always get PAGE_SIZE aligned
+	 * and n*PAGE_SIZED sized I/O requests.
+	 */
+	blk_queue_physical_block_size(zram->queue, PAGE_SIZE);
+	blk_queue_logical_block_size(zram->queue, PAGE_SIZE);
+	blk_queue_io_min(zram->queue, PAGE_SIZE);
+
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->queue);
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, zram->queue);
+	blk_queue_max_discard_sectors(zram->queue, UINT_MAX);
+
+	add_disk(zram->disk);
+
+	ret = sysfs_create_group(&disk_to_dev(zram->disk)->kobj,
+				&zram_disk_attr_group);
+	if (ret < 0)
+		pr_warning("Error creating sysfs group\n");
+
+	return 0;
+}
+
+static void destroy_device(struct zram *zram)
+{
+	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+			&zram_disk_attr_group);
+
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+
+	blk_cleanup_queue(zram->queue);
+
+	if (zram->init_done)
+		__zram_reset_device(zram);
+}
+
+static int __init zram_init(void)
+{
+	int ret, dev_id;
+
+	if (num_devices > 256) {
+		pr_err("Invalid value for num_devices: %u\n", num_devices);
+		return -EINVAL;
+	}
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0) {
+		pr_warning("Unable to get major number\n");
+		return -EBUSY;
+	}
+
+	if (!num_devices) {
+		pr_info("num_devices not specified. Using default: 1\n");
+		num_devices = default_num_devices;
+	}
+
+	/* Allocate the device array and initialize each one */
+	pr_info("Creating %u devices ...\n", num_devices);
+	devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
+	if (!devices) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
+	for (dev_id = 0; dev_id < num_devices; dev_id++) {
+		ret = create_device(&devices[dev_id], dev_id);
+		if (ret)
+			goto free_devices;
+	}
+
+	return 0;
+
+free_devices:
+	while (dev_id)
+		destroy_device(&devices[--dev_id]);
+	kfree(devices);
+unregister:
+	unregister_blkdev(zram_major, "zram");
+	return ret;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		destroy_device(&devices[i]);
+
+	unregister_blkdev(zram_major, "zram");
+
+	kfree(devices);
+	pr_debug("Cleanup done!\n");
+}
+
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device");
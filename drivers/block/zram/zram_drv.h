@@ -0,0 +1,82 @@
+/*
+ * Compressed RAM block device
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DRV_H_
+#define _ZRAM_DRV_H_
+
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+#include "zobj.h"
+
+/* Default number of devices created by the module */
+static const unsigned default_num_devices = 1;
+
+/*
+ * Pages that compress to more than this are stored uncompressed: there
+ * is little to gain and decompression is skipped for them.
+ */
+static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
+
+/* Default disk size, as a percentage of RAM */
+static const unsigned default_disksize_perc_ram = 25;
+
+#define SECTOR_SHIFT		9
+#define SECTOR_SIZE		(1 << SECTOR_SHIFT)
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+
+/* Flags for zram pages (table[page_no].flags) */
+enum zram_pageflags {
+	/* Page is all zeros, nothing is stored for it */
+	ZRAM_ZERO,
+
+	__NR_ZRAM_PAGEFLAGS,
+};
+
+/* One entry per page of the disk */
+struct table {
+	unsigned long handle;	/* zobj handle, 0 if not stored */
+	u32 size;		/* compressed size, PAGE_SIZE if uncompressed */
+	u32 flags;
+};
+
+struct zram_stats {
+	u64 compr_size;		/* compressed size of pages stored */
+	u64 num_reads;		/* failed + successful */
+	u64 num_writes;		/* --do-- */
+	u64 failed_reads;	/* should NEVER! happen */
+	u64 failed_writes;	/* can happen when memory is too low */
+	u64 invalid_io;		/* non-page-aligned I/O requests */
+	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 pages_zero;		/* no. of zero filled pages */
+	u64 pages_stored;	/* no. of pages currently stored */
+	u64 good_compress;	/* no. of pages with compression ratio<=50% */
+	u64 pages_expand;	/* no. of pages stored uncompressed */
+};
+
+struct zram {
+	struct zobj_pool *mem_pool;
+	void *compress_workmem;
+	void *compress_buffer;
+	struct table *table;
+	rwlock_t table_lock;	/* protects table and mem_pool objects */
+	struct mutex lock;	/* protects compress_workmem and _buffer */
+	struct mutex init_lock;	/* protects init_done and disksize */
+	struct request_queue *queue;
+	struct gendisk *disk;
+	int init_done;
+	/*
+	 * This is the limit on amount of *uncompressed* data that
+	 * can be stored in a disk.
+	 */
+	u64 disksize;	/* bytes */
+
+	spinlock_t stat_lock;	/* protects stats */
+	struct zram_stats stats;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Xen Transcendent Memory as a cleancache backend
+ *
+ * Transcendent memory ("tmem") is memory that Xen owns and that guests
+ * can put pages into and get them back from through a hypercall, but
+ * never map.  The memory is shared among all the guests of the host,
+ * so the idle memory of one guest can hold the evicted page cache of
+ * another whose working set does not quite fit.  The pools we create
+ * are private and ephemeral: Xen may drop any page at any time, and a
+ * get returns the page to us and drops it from the pool, exactly what
+ * cleancache expects.
+ *
+ * Only used when booted with "tmem", as not every Xen has tmem enabled
+ * and every failed hypercall would still cost an exit.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/cleancache.h>
+
+#include <xen/interface/xen.h>
+#include <xen/interface/tmem.h>
+#include <asm/xen/hypercall.h>
+#include <asm/xen/hypervisor.h>
+#include <asm/xen/page.h>
+
+static int xen_tmem_op(u32 cmd, u32 pool_id, u64 oid, u32 index,
+		       unsigned long pfn)
+{
+	struct tmem_op op;
+	unsigned long gmfn = xen_pv_domain() ? pfn_to_mfn(pfn) : pfn;
+
+	op.cmd = cmd;
+	op.pool_id = pool_id;
+	op.u.gen.oid.oid[0] = oid;
+	op.u.gen.oid.oid[1] = 0;
+	op.u.gen.oid.oid[2] = 0;
+	op.u.gen.index = index;
+	op.u.gen.tmem_offset = 0;
+	op.u.gen.pfn_offset = 0;
+	op.u.gen.len = 0;
+	set_xen_guest_handle(op.u.gen.gmfn, (void *)gmfn);
+	return HYPERVISOR_tmem_op(&op);
+}
+
+static int xen_tmem_init_fs(size_t pagesize)
+{
+	struct tmem_op op;
+	int pool_id;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+
+	op.cmd = TMEM_NEW_POOL;
+	op.pool_id = 0;
+	op.u.new.uuid[0] = 0;
+	op.u.new.uuid[1] = 0;
+	op.u.new.flags = TMEM_SPEC_VERSION << TMEM_VERSION_SHIFT |
+			 (PAGE_SHIFT - 12) << TMEM_POOL_PAGESIZE_SHIFT;
+	pool_id = HYPERVISOR_tmem_op(&op);
+	if (pool_id < 0)
+		printk(KERN_WARNING "xen tmem: cannot create pool (%d)\n",
+		       pool_id);
+	return pool_id < 0 ? -1 : pool_id;
+}
+
+/* tmem indexes pages of an object with 32 bits only */
+static bool xen_tmem_index_ok(pgoff_t index)
+{
+	return index == (u32)index;
+}
+
+static int xen_tmem_get_page(int pool, ino_t ino, pgoff_t index,
+			     struct page *page)
+{
+	int ret;
+
+	if (!xen_tmem_index_ok(index))
+		return -1;
+	ret = xen_tmem_op(TMEM_GET_PAGE, pool, ino, index, page_to_pfn(page));
+	return ret == 1 ? 0 : -1;
+}
+
+static void xen_tmem_put_page(int pool, ino_t ino, pgoff_t index,
+			      struct page *page)
+{
+	if (xen_tmem_index_ok(index))
+		xen_tmem_op(TMEM_PUT_PAGE, pool, ino, index,
+			    page_to_pfn(page));
+}
+
+static void xen_tmem_flush_page(int pool, ino_t ino, pgoff_t index)
+{
+	if (xen_tmem_index_ok(index))
+		xen_tmem_op(TMEM_FLUSH_PAGE, pool, ino, index, 0);
+}
+
+static void xen_tmem_flush_inode(int pool, ino_t ino)
+{
+	xen_tmem_op(TMEM_FLUSH_OBJECT, pool, ino, 0, 0);
+}
+
+static void xen_tmem_flush_fs(int pool)
+{
+	struct tmem_op op;
+
+	op.cmd = TMEM_DESTROY_POOL;
+	op.pool_id = pool;
+	HYPERVISOR_tmem_op(&op);
+}
+
+static struct cleancache_ops xen_tmem_ops = {
+	.init_fs	= xen_tmem_init_fs,
+	.get_page	= xen_tmem_get_page,
+	.put_page	= xen_tmem_put_page,
+	.flush_page	= xen_tmem_flush_page,
+	.flush_inode	= xen_tmem_flush_inode,
+	.flush_fs	= xen_tmem_flush_fs,
+};
+
+static int tmem_enabled __initdata;
+
+static int __init enable_tmem(char *s)
+{
+	tmem_enabled = 1;
+	return 1;
+}
+__setup("tmem", enable_tmem);
+
+static int __init xen_tmem_init(void)
+{
+	int err;
+
+	if (!xen_domain() || !tmem_enabled)
+		return 0;
+
+	err = cleancache_register_ops(&xen_tmem_ops);
+	if (err) {
+		printk(KERN_WARNING
+		       "xen tmem: another cleancache backend is registered\n");
+		return err;
+	}
+	printk(KERN_INFO "xen tmem: cleancache enabled\n");
+	return 0;
+}
+
+module_init(xen_tmem_init);
@@ -378,20 +378,6 @@ struct squashfs_cache_entry *squashfs_get_fragment(struct super_block *sb,
 }
 
 
-/*
- * Read and decompress the datablock located at <start_block> in the
- * filesystem.  The cache is used here to avoid duplicating locking and
- * read/decompress code.
- */
-struct squashfs_cache_entry *squashfs_get_datablock(struct super_block *sb,
-				u64 start_block, int length)
-{
-	struct squashfs_sb_info *msblk = sb->s_fs_info;
-
-	return squashfs_cache_get(sb, msblk->read_page, start_block, length);
-}
-
-
 /*
  * Read a filesystem table (uncompressed sequence of bytes) from disk
  */
@@ -372,6 +372,117 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages it covers,
+ * avoiding an intermediate copy through a cache entry.  Pages which can't be
+ * grabbed without blocking (or which are already uptodate), and the part of
+ * the block beyond the end of the file, are decompressed into a scratch page
+ * and discarded.  Highmem pages are decompressed into a bounce buffer and
+ * copied with kmap_atomic(), as kmap()ing a whole block's worth of pages
+ * at once could exhaust the pkmap area.  The page we've been called to fill
+ * is left locked for the caller.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages = 1 << (msblk->block_log - PAGE_CACHE_SHIFT);
+	int start_index = target_page->index & ~(pages - 1);
+	int file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int i, n, res = -ENOMEM;
+	struct page **page;
+	void **data, *scratch = NULL;
+
+	/* Don't grab pages beyond the end of the file */
+	n = min(pages, file_pages - start_index);
+
+	/*
+	 * squashfs_read_data() may fill up to a whole block whatever the
+	 * file size says, so there must be a buffer for every page of it.
+	 */
+	page = kcalloc(pages, sizeof(*page), GFP_KERNEL);
+	data = kcalloc(pages, sizeof(*data), GFP_KERNEL);
+	if (page == NULL || data == NULL)
+		goto out;
+
+	for (i = 0; i < pages; i++) {
+		if (start_index + i == target_page->index)
+			page[i] = target_page;
+		else if (i < n) {
+			page[i] = grab_cache_page_nowait(target_page->mapping,
+				start_index + i);
+			if (page[i] && PageUptodate(page[i])) {
+				unlock_page(page[i]);
+				page_cache_release(page[i]);
+				page[i] = NULL;
+			}
+		}
+
+		if (page[i] && !PageHighMem(page[i]))
+			data[i] = page_address(page[i]);
+		else if (page[i]) {
+			data[i] = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+			if (data[i] == NULL)
+				goto release_pages;
+		} else {
+			if (scratch == NULL) {
+				scratch = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+				if (scratch == NULL)
+					goto release_pages;
+			}
+			data[i] = scratch;
+		}
+	}
+
+	res = squashfs_read_data(inode->i_sb, data, block, bsize, NULL,
+		msblk->block_size, pages);
+	if (res < 0)
+		goto release_pages;
+
+	/* Zero the tail of the last page, or any pages the block didn't fill */
+	for (i = 0; i < n; i++) {
+		int avail = min_t(int, max(res - (i << PAGE_CACHE_SHIFT), 0),
+			PAGE_CACHE_SIZE);
+
+		if (page[i] == NULL)
+			continue;
+		if (avail < PAGE_CACHE_SIZE)
+			memset(data[i] + avail, 0, PAGE_CACHE_SIZE - avail);
+		if (PageHighMem(page[i])) {
+			void *pageaddr = kmap_atomic(page[i], KM_USER0);
+
+			memcpy(pageaddr, data[i], PAGE_CACHE_SIZE);
+			kunmap_atomic(pageaddr, KM_USER0);
+		}
+	}
+	res = 0;
+
+release_pages:
+	for (i = 0; i < n; i++) {
+		if (page[i] == NULL)
+			continue;
+		if (PageHighMem(page[i]))
+			kfree(data[i]);
+		if (page[i] == target_page)
+			continue;
+		if (res == 0) {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		}
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+
+out:
+	kfree(scratch);
+	kfree(data);
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -411,17 +522,18 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock directly into the
+			 * page cache.
 			 */
-			buffer = squashfs_get_datablock(inode->i_sb,
-								block, bsize);
-			if (buffer->error) {
+			if (squashfs_readpage_block(page, block, bsize)) {
 				ERROR("Unable to read page, block %llx, size %x"
 					"\n", block, bsize);
-				squashfs_cache_put(buffer);
 				goto error_out;
 			}
-			bytes = buffer->length;
+			flush_dcache_page(page);
+			SetPageUptodate(page);
+			unlock_page(page);
+			return 0;
 		}
 	} else {
 		/*
@@ -444,10 +556,10 @@ static int squashfs_readpage(struct file *file, struct page *page)
 	}
 
 	/*
-	 * Loop copying datablock into pages.  As the datablock likely covers
-	 * many PAGE_CACHE_SIZE pages (default block size is 128 KiB) explicitly
-	 * grab the pages from the page cache, except for the page that we've
-	 * been called to fill.
+	 * Loop copying fragment (or zeroing hole) into pages.  As the block
+	 * likely covers many PAGE_CACHE_SIZE pages (default block size is
+	 * 128 KiB) explicitly grab the pages from the page cache, except for
+	 * the page that we've been called to fill.
 	 */
 	for (i = start_index; i <= end_index && bytes > 0; i++,
 			bytes -= PAGE_CACHE_SIZE, offset += PAGE_CACHE_SIZE) {
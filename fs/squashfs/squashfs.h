@@ -47,10 +47,17 @@ extern int squashfs_read_metadata(struct super_block *, void *, u64 *,
 				int *, int);
 extern struct squashfs_cache_entry *squashfs_get_fragment(struct super_block *,
 				u64, int);
-extern struct squashfs_cache_entry *squashfs_get_datablock(struct super_block *,
-				u64, int);
 extern int squashfs_read_table(struct super_block *, void *, u64, int);
 
+/* stream.c */
+extern int squashfs_stream_create(struct squashfs_sb_info *, int);
+extern void squashfs_stream_destroy(struct squashfs_sb_info *);
+extern int squashfs_decompress(struct squashfs_sb_info *, void **,
+				struct buffer_head **, int, int, int, int, int);
+
+/* decompressor.c */
+extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
+
 /* export.c */
 extern __le64 *squashfs_read_inode_lookup_table(struct super_block *, u64,
 				unsigned int);
@@ -212,6 +212,8 @@ struct meta_index {
  * definitions for structures on disk
  */
 #define ZLIB_COMPRESSION	 1
+#define LZMA_COMPRESSION	 2
+#define LZO_COMPRESSION		 3
 
 struct squashfs_super_block {
 	__le32			s_magic;
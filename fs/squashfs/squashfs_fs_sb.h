@@ -51,20 +51,27 @@ struct squashfs_cache_entry {
 	void			**data;
 };
 
+/* Decompressor stream modes, see stream.c */
+#define SQUASHFS_DECOMP_SINGLE	0
+#define SQUASHFS_DECOMP_MULTI	1
+#define SQUASHFS_DECOMP_PERCPU	2
+
+struct squashfs_stream;
+struct squashfs_decompressor;
+
 struct squashfs_sb_info {
 	int			devblksize;
 	int			devblksize_log2;
 	struct squashfs_cache	*block_cache;
 	struct squashfs_cache	*fragment_cache;
-	struct squashfs_cache	*read_page;
 	int			next_meta_index;
 	__le64			*id_table;
 	__le64			*fragment_index;
 	unsigned int		*fragment_index_2;
-	struct mutex		read_data_mutex;
 	struct mutex		meta_index_mutex;
 	struct meta_index	*meta_index;
-	z_stream		stream;
+	const struct squashfs_decompressor *decompressor;
+	struct squashfs_stream	*stream;
 	__le64			*inode_lookup_table;
 	u64			inode_table;
 	u64			directory_table;
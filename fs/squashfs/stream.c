@@ -0,0 +1,305 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * stream.c
+ */
+
+/*
+ * This file manages the decompressor streams of a mounted filesystem.
+ * Three modes are supported, selected by the "threads=" mount option:
+ *
+ * single - one stream serialised by a mutex.  Lowest memory use, but
+ *	concurrent readers queue behind one another.
+ *
+ * multi - a pool of streams, grown on demand when every stream is busy
+ *	up to twice the number of online CPUs.  Readers only wait if the
+ *	pool is exhausted.
+ *
+ * percpu - one stream per possible CPU.  Decompression runs with
+ *	preemption disabled on the local CPU's stream, so there is no
+ *	contention at all, at the cost of a stream per CPU.
+ *
+ * In all modes the caller must have read in the compressed block first, the
+ * decompressor itself never sleeps on I/O.
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "decompressor.h"
+
+struct decomp_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_stream {
+	int			mode;
+
+	/* SQUASHFS_DECOMP_SINGLE */
+	struct mutex		mutex;
+	void			*stream;
+
+	/* SQUASHFS_DECOMP_MULTI */
+	spinlock_t		lock;
+	struct list_head	free_list;
+	int			avail;
+	int			max;
+	wait_queue_head_t	wait;
+
+	/* SQUASHFS_DECOMP_PERCPU */
+	void			**percpu;
+};
+
+
+static void free_stream_list(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *s)
+{
+	struct decomp_stream *decomp, *next;
+
+	list_for_each_entry_safe(decomp, next, &s->free_list, list) {
+		list_del(&decomp->list);
+		squashfs_decompressor_free(msblk, decomp->stream);
+		kfree(decomp);
+	}
+}
+
+
+static struct decomp_stream *alloc_decomp_stream(struct squashfs_sb_info
+	*msblk)
+{
+	struct decomp_stream *decomp = kmalloc(sizeof(*decomp), GFP_KERNEL);
+
+	if (decomp == NULL)
+		return NULL;
+
+	decomp->stream = squashfs_decompressor_init(msblk);
+	if (decomp->stream == NULL) {
+		kfree(decomp);
+		return NULL;
+	}
+
+	return decomp;
+}
+
+
+int squashfs_stream_create(struct squashfs_sb_info *msblk, int mode)
+{
+	struct squashfs_stream *s;
+	struct decomp_stream *decomp;
+	int cpu;
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (s == NULL)
+		return -ENOMEM;
+
+	s->mode = mode;
+	INIT_LIST_HEAD(&s->free_list);
+
+	switch (mode) {
+	case SQUASHFS_DECOMP_SINGLE:
+		mutex_init(&s->mutex);
+		s->stream = squashfs_decompressor_init(msblk);
+		if (s->stream == NULL)
+			goto failed;
+		break;
+
+	case SQUASHFS_DECOMP_MULTI:
+		spin_lock_init(&s->lock);
+		init_waitqueue_head(&s->wait);
+		s->max = num_online_cpus() * 2;
+
+		/*
+		 * Always have one stream available so that a reader can make
+		 * progress even if later allocations fail.
+		 */
+		decomp = alloc_decomp_stream(msblk);
+		if (decomp == NULL)
+			goto failed;
+		list_add(&decomp->list, &s->free_list);
+		s->avail = 1;
+		break;
+
+	case SQUASHFS_DECOMP_PERCPU:
+		s->percpu = alloc_percpu(void *);
+		if (s->percpu == NULL)
+			goto failed;
+
+		for_each_possible_cpu(cpu) {
+			void *stream = squashfs_decompressor_init(msblk);
+			if (stream == NULL)
+				goto failed;
+			*per_cpu_ptr(s->percpu, cpu) = stream;
+		}
+		break;
+
+	default:
+		goto failed;
+	}
+
+	msblk->stream = s;
+	return 0;
+
+failed:
+	msblk->stream = s;
+	squashfs_stream_destroy(msblk);
+	return -ENOMEM;
+}
+
+
+void squashfs_stream_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *s = msblk->stream;
+	int cpu;
+
+	if (s == NULL)
+		return;
+
+	switch (s->mode) {
+	case SQUASHFS_DECOMP_SINGLE:
+		squashfs_decompressor_free(msblk, s->stream);
+		break;
+
+	case SQUASHFS_DECOMP_MULTI:
+		free_stream_list(msblk, s);
+		break;
+
+	case SQUASHFS_DECOMP_PERCPU:
+		if (s->percpu) {
+			for_each_possible_cpu(cpu)
+				squashfs_decompressor_free(msblk,
+					*per_cpu_ptr(s->percpu, cpu));
+			free_percpu(s->percpu);
+		}
+		break;
+	}
+
+	kfree(s);
+	msblk->stream = NULL;
+}
+
+
+/*
+ * Take a stream from the pool, allocating a new one if all are busy and the
+ * pool has not reached its maximum size, otherwise wait for one to be freed.
+ */
+static struct decomp_stream *get_decomp_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *s)
+{
+	struct decomp_stream *decomp;
+
+	spin_lock(&s->lock);
+	while (1) {
+		if (!list_empty(&s->free_list)) {
+			decomp = list_entry(s->free_list.next,
+				struct decomp_stream, list);
+			list_del(&decomp->list);
+			break;
+		}
+
+		if (s->avail >= s->max) {
+			spin_unlock(&s->lock);
+			wait_event(s->wait, !list_empty(&s->free_list));
+			spin_lock(&s->lock);
+			continue;
+		}
+
+		/* Reserve a slot before dropping the lock to allocate */
+		s->avail++;
+		spin_unlock(&s->lock);
+
+		decomp = alloc_decomp_stream(msblk);
+		if (decomp != NULL)
+			return decomp;
+
+		/* Allocation failed, fall back to waiting for a stream */
+		spin_lock(&s->lock);
+		s->avail--;
+		if (s->avail == 0) {
+			spin_unlock(&s->lock);
+			return NULL;
+		}
+		spin_unlock(&s->lock);
+		wait_event(s->wait, !list_empty(&s->free_list));
+		spin_lock(&s->lock);
+	}
+	spin_unlock(&s->lock);
+
+	return decomp;
+}
+
+
+static void put_decomp_stream(struct squashfs_stream *s,
+	struct decomp_stream *decomp)
+{
+	spin_lock(&s->lock);
+	list_add(&decomp->list, &s->free_list);
+	spin_unlock(&s->lock);
+	wake_up(&s->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *s = msblk->stream;
+	struct decomp_stream *decomp;
+	void **stream;
+	int res;
+
+	switch (s->mode) {
+	case SQUASHFS_DECOMP_MULTI:
+		decomp = get_decomp_stream(msblk, s);
+		if (decomp == NULL)
+			return -ENOMEM;
+		res = squashfs_decompressor_uncompress(msblk, decomp->stream,
+			buffer, bh, b, offset, length, srclength, pages);
+		put_decomp_stream(s, decomp);
+		break;
+
+	case SQUASHFS_DECOMP_PERCPU:
+		stream = per_cpu_ptr(s->percpu, get_cpu());
+		res = squashfs_decompressor_uncompress(msblk, *stream, buffer,
+			bh, b, offset, length, srclength, pages);
+		put_cpu();
+		break;
+
+	default:
+		mutex_lock(&s->mutex);
+		res = squashfs_decompressor_uncompress(msblk, s->stream,
+			buffer, bh, b, offset, length, srclength, pages);
+		mutex_unlock(&s->mutex);
+	}
+
+	return res;
+}
+
@@ -176,6 +176,20 @@ int yaffs_CheckpointOpen(yaffs_Device *dev, int forWriting)
 
 		for (i = 0; i < dev->checkpointMaxBlocks; i++)
 			dev->checkpointBlockList[i] = -1;
+
+		/* Read ahead several chunks per request if the driver can.
+		 * Not having the buffers just means reading one at a time.
+		 */
+		dev->checkpointPrefetchFirst = -1;
+		dev->checkpointPrefetchCount = 0;
+		if (dev->readChunksWithTagsFromNAND) {
+			dev->checkpointPrefetchBuffer =
+				YMALLOC(YAFFS_CHECKPOINT_PREFETCH_CHUNKS *
+					dev->totalBytesPerChunk);
+			dev->checkpointPrefetchTags =
+				YMALLOC(YAFFS_CHECKPOINT_PREFETCH_CHUNKS *
+					sizeof(yaffs_ExtendedTags));
+		}
 	}
 
 	return 1;
@@ -277,6 +291,47 @@ int yaffs_CheckpointWrite(yaffs_Device *dev, const void *data, int nBytes)
 	return i;
 }
 
+/* Read one checkpoint chunk into checkpointBuffer, serving it from the
+ * prefetch buffer if possible. On a miss the rest of the block (up to
+ * YAFFS_CHECKPOINT_PREFETCH_CHUNKS chunks) is fetched in one request.
+ */
+static void yaffs_CheckpointReadChunk(yaffs_Device *dev, int realignedChunk,
+				      yaffs_ExtendedTags *tags)
+{
+	int i = realignedChunk - dev->checkpointPrefetchFirst;
+	int nChunks;
+
+	if (dev->checkpointPrefetchBuffer && dev->checkpointPrefetchTags &&
+	    (dev->checkpointPrefetchFirst < 0 ||
+	     i < 0 || i >= dev->checkpointPrefetchCount)) {
+		nChunks = dev->nChunksPerBlock - dev->checkpointCurrentChunk;
+		if (nChunks > YAFFS_CHECKPOINT_PREFETCH_CHUNKS)
+			nChunks = YAFFS_CHECKPOINT_PREFETCH_CHUNKS;
+
+		dev->checkpointPrefetchFirst = realignedChunk;
+		dev->checkpointPrefetchCount = 0;
+		i = 0;
+
+		if (dev->readChunksWithTagsFromNAND(dev, realignedChunk,
+					nChunks,
+					dev->checkpointPrefetchBuffer,
+					dev->checkpointPrefetchTags) == YAFFS_OK)
+			dev->checkpointPrefetchCount = nChunks;
+	}
+
+	if (dev->checkpointPrefetchCount > 0 &&
+	    i >= 0 && i < dev->checkpointPrefetchCount) {
+		memcpy(dev->checkpointBuffer,
+		       &dev->checkpointPrefetchBuffer[i * dev->nDataBytesPerChunk],
+		       dev->nDataBytesPerChunk);
+		*tags = dev->checkpointPrefetchTags[i];
+		return;
+	}
+
+	dev->readChunkWithTagsFromNAND(dev, realignedChunk,
+			dev->checkpointBuffer, tags);
+}
+
 int yaffs_CheckpointRead(yaffs_Device *dev, void *data, int nBytes)
 {
 	int i = 0;
@@ -319,9 +374,7 @@ int yaffs_CheckpointRead(yaffs_Device *dev, void *data, int nBytes)
 
 				/* read in the next chunk */
 				/* printf("read checkpoint page %d\n",dev->checkpointPage); */
-				dev->readChunkWithTagsFromNAND(dev,
-						realignedChunk,
-						dev->checkpointBuffer,
+				yaffs_CheckpointReadChunk(dev, realignedChunk,
 						&tags);
 
 				if (tags.chunkId != (dev->checkpointPageSequence + 1) ||
@@ -375,6 +428,15 @@ int yaffs_CheckpointClose(yaffs_Device *dev)
 		dev->checkpointBlockList = NULL;
 	}
 
+	if (dev->checkpointPrefetchBuffer) {
+		YFREE(dev->checkpointPrefetchBuffer);
+		dev->checkpointPrefetchBuffer = NULL;
+	}
+	if (dev->checkpointPrefetchTags) {
+		YFREE(dev->checkpointPrefetchTags);
+		dev->checkpointPrefetchTags = NULL;
+	}
+
 	dev->nFreeChunks -= dev->blocksInCheckpoint * dev->nChunksPerBlock;
 	dev->nErasedBlocks -= dev->blocksInCheckpoint;
 
@@ -117,6 +117,7 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 #include "yaffs_mtdif.h"
 #include "yaffs_mtdif1.h"
 #include "yaffs_mtdif2.h"
+#include "yaffs_packedtags2.h"
 
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
@@ -1845,6 +1846,40 @@ static void yaffs_read_inode(struct inode *inode)
 
 static YLIST_HEAD(yaffs_dev_list);
 
+/* Memory pressure: release free tnodes on every mounted device back to
+ * the slab allocator. Devices that are busy are skipped rather than
+ * waited for, since we may be called from within a yaffs allocation.
+ */
+static int yaffs_tnode_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct ylist_head *item;
+	yaffs_Device *dev;
+	int nFree = 0;
+
+	if (nr_to_scan && !(gfp_mask & __GFP_FS))
+		return -1;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+	ylist_for_each(item, &yaffs_dev_list) {
+		dev = ylist_entry(item, yaffs_Device, devList);
+		if (down_trylock(&dev->grossLock))
+			continue;
+		if (nr_to_scan > 0)
+			nr_to_scan -= yaffs_ShrinkTnodes(dev, nr_to_scan);
+		nFree += dev->nFreeTnodes;
+		yaffs_GrossUnlock(dev);
+	}
+	unlock_kernel();
+
+	return nFree;
+}
+
+static struct shrinker yaffs_tnode_shrinker = {
+	.shrink = yaffs_tnode_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 #if 0 /* not used */
 static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 {
@@ -1902,6 +1937,11 @@ static void yaffs_put_super(struct super_block *sb)
 		dev->spareBuffer = NULL;
 	}
 
+	if (dev->blockSpareBuffer) {
+		YFREE(dev->blockSpareBuffer);
+		dev->blockSpareBuffer = NULL;
+	}
+
 	kfree(dev);
 }
 
@@ -2203,6 +2243,18 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
 		dev->totalBytesPerChunk = mtd->writesize;
 		dev->nChunksPerBlock = mtd->erasesize / mtd->writesize;
+
+		/* Scanning and checkpoint restore can read a whole block's
+		 * tags in one go if the spare layout leaves room for them.
+		 */
+		if (!dev->inbandTags &&
+		    mtd->oobavail >= sizeof(yaffs_PackedTags2)) {
+			dev->blockSpareBuffer =
+				YMALLOC(mtd->oobavail * dev->nChunksPerBlock);
+			if (dev->blockSpareBuffer)
+				dev->readChunksWithTagsFromNAND =
+				    nandmtd2_ReadChunksWithTagsFromNAND;
+		}
 #else
 		dev->totalBytesPerChunk = mtd->oobblock;
 		dev->nChunksPerBlock = mtd->erasesize / mtd->oobblock;
@@ -2643,6 +2695,8 @@ static int __init init_yaffs_fs(void)
 	} else
 		return -ENOMEM;
 
+	register_shrinker(&yaffs_tnode_shrinker);
+
 	/* Now add the file system entries */
 
 	fsinst = fs_to_install;
@@ -2665,6 +2719,8 @@ static int __init init_yaffs_fs(void)
 			}
 			fsinst++;
 		}
+
+		unregister_shrinker(&yaffs_tnode_shrinker);
 	}
 
 	return error;
@@ -2680,6 +2736,8 @@ static void __exit exit_yaffs_fs(void)
 
 	remove_proc_entry("yaffs", YPROC_ROOT);
 
+	unregister_shrinker(&yaffs_tnode_shrinker);
+
 	fsinst = fs_to_install;
 
 	while (fsinst->fst) {
@@ -2689,6 +2747,8 @@ static void __exit exit_yaffs_fs(void)
 		}
 		fsinst++;
 	}
+
+	yaffs_DestroyTnodeCaches();
 }
 
 module_init(init_yaffs_fs)
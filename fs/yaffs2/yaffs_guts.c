@@ -1145,11 +1145,126 @@ static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
  * in the tnode.
  */
 
+/* Calculate the tnode size in bytes for variable width tnode support.
+ * Level 0 tnodes are packed to tnodeWidth bits per entry.
+ * Must be a multiple of 32-bits  */
+static int yaffs_TnodeSize(yaffs_Device *dev)
+{
+	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
+
+	if (tnodeSize < sizeof(yaffs_Tnode))
+		tnodeSize = sizeof(yaffs_Tnode);
+
+	return tnodeSize;
+}
+
 /* yaffs_CreateTnodes creates a bunch more tnodes and
  * adds them to the tnode free list.
  * Don't use this function directly
  */
 
+#ifdef __KERNEL__
+
+/* In the kernel tnodes are carved individually from a slab cache so that
+ * free tnodes can be handed back to the system (see yaffs_ShrinkTnodes)
+ * rather than pinned on the free list forever.
+ */
+
+/* One cache per tnode size, shared by every device that needs that size.
+ * Caches are only destroyed when the module goes away: the slab allocator
+ * keeps a pointer to the cache name, which must outlive it.
+ */
+typedef struct {
+	struct ylist_head list;
+	int tnodeSize;
+	struct kmem_cache *cache;
+	char name[24];
+} yaffs_TnodeCache;
+
+static YLIST_HEAD(yaffs_tnodeCaches);
+static DEFINE_MUTEX(yaffs_tnodeCacheLock);
+
+static struct kmem_cache *yaffs_FindTnodeCache(int tnodeSize)
+{
+	struct ylist_head *lh;
+	yaffs_TnodeCache *tc;
+	struct kmem_cache *cache = NULL;
+
+	mutex_lock(&yaffs_tnodeCacheLock);
+
+	ylist_for_each(lh, &yaffs_tnodeCaches) {
+		tc = ylist_entry(lh, yaffs_TnodeCache, list);
+		if (tc->tnodeSize == tnodeSize) {
+			cache = tc->cache;
+			goto out;
+		}
+	}
+
+	tc = YMALLOC(sizeof(yaffs_TnodeCache));
+	if (!tc)
+		goto out;
+
+	tc->tnodeSize = tnodeSize;
+	snprintf(tc->name, sizeof(tc->name), "yaffs_tnode_%d", tnodeSize);
+	tc->cache = kmem_cache_create(tc->name,
+				      tnodeSize, 0,
+				      SLAB_RECLAIM_ACCOUNT, NULL);
+	if (!tc->cache) {
+		YFREE(tc);
+		goto out;
+	}
+	ylist_add(&tc->list, &yaffs_tnodeCaches);
+	cache = tc->cache;
+out:
+	mutex_unlock(&yaffs_tnodeCacheLock);
+	return cache;
+}
+
+/* Called at module exit, once every device is gone */
+void yaffs_DestroyTnodeCaches(void)
+{
+	yaffs_TnodeCache *tc;
+
+	while (!ylist_empty(&yaffs_tnodeCaches)) {
+		tc = ylist_entry(yaffs_tnodeCaches.next, yaffs_TnodeCache, list);
+		ylist_del(&tc->list);
+		kmem_cache_destroy(tc->cache);
+		YFREE(tc);
+	}
+}
+
+static int yaffs_CreateTnodes(yaffs_Device *dev, int nTnodes)
+{
+	int i;
+	yaffs_Tnode *tn;
+
+	if (!dev->tnodeCache)
+		return YAFFS_FAIL;
+
+	for (i = 0; i < nTnodes; i++) {
+		tn = kmem_cache_alloc(dev->tnodeCache, GFP_NOFS);
+		if (!tn) {
+			T(YAFFS_TRACE_ERROR,
+				(TSTR("yaffs: Could not allocate Tnodes" TENDSTR)));
+			return (i > 0) ? YAFFS_OK : YAFFS_FAIL;
+		}
+
+		tn->internal[0] = dev->freeTnodes;
+#ifdef CONFIG_YAFFS_TNODE_LIST_DEBUG
+		tn->internal[YAFFS_NTNODES_INTERNAL] = (void *)1;
+#endif
+		dev->freeTnodes = tn;
+		dev->nFreeTnodes++;
+		dev->nTnodesCreated++;
+	}
+
+	T(YAFFS_TRACE_ALLOCATE, (TSTR("yaffs: Tnodes added" TENDSTR)));
+
+	return YAFFS_OK;
+}
+
+#else
+
 static int yaffs_CreateTnodes(yaffs_Device *dev, int nTnodes)
 {
 	int i;
@@ -1163,12 +1278,7 @@ static int yaffs_CreateTnodes(yaffs_Device *dev, int nTnodes)
 	if (nTnodes < 1)
 		return YAFFS_OK;
 
-	/* Calculate the tnode size in bytes for variable width tnode support.
-	 * Must be a multiple of 32-bits  */
-	tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
+	tnodeSize = yaffs_TnodeSize(dev);
 
 	/* make these things */
 
@@ -1235,6 +1345,8 @@ static int yaffs_CreateTnodes(yaffs_Device *dev, int nTnodes)
 	return YAFFS_OK;
 }
 
+#endif
+
 /* GetTnode gets us a clean tnode. Tries to make allocate more if we run out */
 
 static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device *dev)
@@ -1266,13 +1378,9 @@ static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device *dev)
 static yaffs_Tnode *yaffs_GetTnode(yaffs_Device *dev)
 {
 	yaffs_Tnode *tn = yaffs_GetTnodeRaw(dev);
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
 
 	if (tn)
-		memset(tn, 0, tnodeSize);
+		memset(tn, 0, yaffs_TnodeSize(dev));
 
 	return tn;
 }
@@ -1296,6 +1404,95 @@ static void yaffs_FreeTnode(yaffs_Device *dev, yaffs_Tnode *tn)
 	dev->nCheckpointBlocksRequired = 0; /* force recalculation*/
 }
 
+/* FreeTnodeTree puts a whole (sub)tree of tnodes back on the free list */
+static void yaffs_FreeTnodeTree(yaffs_Device *dev, yaffs_Tnode *tn, int level)
+{
+	int i;
+
+	if (!tn)
+		return;
+
+	if (level > 0)
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_FreeTnodeTree(dev, tn->internal[i], level - 1);
+
+	yaffs_FreeTnode(dev, tn);
+}
+
+#ifdef __KERNEL__
+
+/* Hand free tnodes back to the slab cache. Returns the number released. */
+int yaffs_ShrinkTnodes(yaffs_Device *dev, int nToFree)
+{
+	yaffs_Tnode *tn;
+	int nFreed = 0;
+
+	while (dev->freeTnodes && nFreed < nToFree) {
+		tn = dev->freeTnodes;
+		dev->freeTnodes = tn->internal[0];
+		dev->nFreeTnodes--;
+		dev->nTnodesCreated--;
+		kmem_cache_free(dev->tnodeCache, tn);
+		nFreed++;
+	}
+
+	if (nFreed)
+		kmem_cache_shrink(dev->tnodeCache);
+
+	return nFreed;
+}
+
+static void yaffs_DeinitialiseTnodes(yaffs_Device *dev)
+{
+	struct ylist_head *lh;
+	yaffs_Object *obj;
+	int i;
+
+	if (!dev->tnodeCache)
+		return;
+
+	/* Every tnode in use hangs off the tree of a file that is still
+	 * hashed, so walk those trees to give them all back.
+	 */
+	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each(lh, &dev->objectBucket[i].list) {
+			obj = ylist_entry(lh, yaffs_Object, hashLink);
+			if (obj->variantType == YAFFS_OBJECT_TYPE_FILE) {
+				yaffs_FreeTnodeTree(dev,
+					obj->variant.fileVariant.top,
+					obj->variant.fileVariant.topLevel);
+				obj->variant.fileVariant.top = NULL;
+			}
+		}
+	}
+
+	yaffs_ShrinkTnodes(dev, dev->nFreeTnodes);
+
+	if (dev->nTnodesCreated)
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: %d tnodes leaked" TENDSTR),
+		   dev->nTnodesCreated));
+
+	dev->freeTnodes = NULL;
+	dev->nFreeTnodes = 0;
+	dev->nTnodesCreated = 0;
+}
+
+static void yaffs_InitialiseTnodes(yaffs_Device *dev)
+{
+	dev->allocatedTnodeList = NULL;
+	dev->freeTnodes = NULL;
+	dev->nFreeTnodes = 0;
+	dev->nTnodesCreated = 0;
+
+	dev->tnodeCache = yaffs_FindTnodeCache(yaffs_TnodeSize(dev));
+	if (!dev->tnodeCache)
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: Could not create tnode cache" TENDSTR)));
+}
+
+#else
+
 static void yaffs_DeinitialiseTnodes(yaffs_Device *dev)
 {
 	/* Free the list of allocated tnodes */
@@ -1322,6 +1519,8 @@ static void yaffs_InitialiseTnodes(yaffs_Device *dev)
 	dev->nTnodesCreated = 0;
 }
 
+#endif
+
 
 void yaffs_PutLevel0Tnode(yaffs_Device *dev, yaffs_Tnode *tn, unsigned pos,
 		unsigned val)
@@ -1738,8 +1937,9 @@ static void yaffs_SoftDeleteFile(yaffs_Object *obj)
 	    obj->variantType == YAFFS_OBJECT_TYPE_FILE && !obj->softDeleted) {
 		if (obj->nDataChunks <= 0) {
 			/* Empty file with no duplicate object headers, just delete it immediately */
-			yaffs_FreeTnode(obj->myDev,
-					obj->variant.fileVariant.top);
+			yaffs_FreeTnodeTree(obj->myDev,
+					obj->variant.fileVariant.top,
+					obj->variant.fileVariant.topLevel);
 			obj->variant.fileVariant.top = NULL;
 			T(YAFFS_TRACE_TRACING,
 			  (TSTR("yaffs: Deleting empty file %d" TENDSTR),
@@ -2003,6 +2203,13 @@ static void yaffs_FreeObject(yaffs_Object *tn)
 	}
 #endif
 
+	/* Whatever is left of a file's tree goes with it */
+	if (tn->variantType == YAFFS_OBJECT_TYPE_FILE) {
+		yaffs_FreeTnodeTree(dev, tn->variant.fileVariant.top,
+				    tn->variant.fileVariant.topLevel);
+		tn->variant.fileVariant.top = NULL;
+	}
+
 	yaffs_UnhashObject(tn);
 
 #ifdef VALGRIND_TEST
@@ -2845,12 +3052,7 @@ static int yaffs_CalcCheckpointBlocksRequired(yaffs_Device *dev)
 		int nBytes = 0;
 		int nBlocks;
 		int devBlocks = (dev->endBlock - dev->startBlock + 1);
-		int tnodeSize;
-
-		tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-		if (tnodeSize < sizeof(yaffs_Tnode))
-			tnodeSize = sizeof(yaffs_Tnode);
+		int tnodeSize = yaffs_TnodeSize(dev);
 
 		nBytes += sizeof(yaffs_CheckpointValidity);
 		nBytes += sizeof(yaffs_CheckpointDevice);
@@ -3102,9 +3304,11 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 					 * Can be discarded and the file deleted.
 					 */
 					object->hdrChunk = 0;
-					yaffs_FreeTnode(object->myDev,
+					yaffs_FreeTnodeTree(object->myDev,
 							object->variant.
-							fileVariant.top);
+							fileVariant.top,
+							object->variant.
+							fileVariant.topLevel);
 					object->variant.fileVariant.top = NULL;
 					yaffs_DoGenericObjectDeletion(object);
 
@@ -3176,9 +3380,11 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 			    yaffs_FindObjectByNumber(dev,
 						     dev->gcCleanupList[i]);
 			if (object) {
-				yaffs_FreeTnode(dev,
+				yaffs_FreeTnodeTree(dev,
+						object->variant.fileVariant.
+						top,
 						object->variant.fileVariant.
-						top);
+						topLevel);
 				object->variant.fileVariant.top = NULL;
 				T(YAFFS_TRACE_GC,
 				  (TSTR
@@ -4314,10 +4520,7 @@ static int yaffs_CheckpointTnodeWorker(yaffs_Object *in, yaffs_Tnode *tn,
 	int i;
 	yaffs_Device *dev = in->myDev;
 	int ok = 1;
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
+	int tnodeSize = yaffs_TnodeSize(dev);
 
 
 	if (tn) {
@@ -4369,10 +4572,7 @@ static int yaffs_ReadCheckpointTnodes(yaffs_Object *obj)
 	yaffs_FileStructure *fileStructPtr = &obj->variant.fileVariant;
 	yaffs_Tnode *tn;
 	int nread = 0;
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
+	int tnodeSize = yaffs_TnodeSize(dev);
 
 	ok = (yaffs_CheckpointRead(dev, &baseChunk, sizeof(baseChunk)) == sizeof(baseChunk));
 
@@ -4393,6 +4593,10 @@ static int yaffs_ReadCheckpointTnodes(yaffs_Object *obj)
 							baseChunk,
 							tn) ? 1 : 0;
 
+		/* A tnode that didn't make it into the tree goes back */
+		if (tn && !ok)
+			yaffs_FreeTnode(dev, tn);
+
 		if (ok)
 			ok = (yaffs_CheckpointRead(dev, &baseChunk, sizeof(baseChunk)) == sizeof(baseChunk));
 
@@ -5187,7 +5391,8 @@ int yaffs_DeleteFile(yaffs_Object *in)
 		return deleted ? YAFFS_OK : YAFFS_FAIL;
 	} else {
 		/* The file has no data chunks so we toss it immediately */
-		yaffs_FreeTnode(in->myDev, in->variant.fileVariant.top);
+		yaffs_FreeTnodeTree(in->myDev, in->variant.fileVariant.top,
+				    in->variant.fileVariant.topLevel);
 		in->variant.fileVariant.top = NULL;
 		yaffs_DoGenericObjectDeletion(in);
 
@@ -5589,6 +5794,21 @@ static void yaffs_EmptyLostAndFound(yaffs_Device *dev)
 	yaffs_DeleteDirectoryContents(dev->lostNFoundDir);
 }
 
+/* The scan makes an object a file when it meets the object's data before
+ * its header. Should the header say otherwise, the file variant is about
+ * to be overwritten, so free its tnodes before they become unreachable.
+ */
+static void yaffs_SetScannedObjectType(yaffs_Object *in, yaffs_ObjectType type)
+{
+	if (in->variantType == YAFFS_OBJECT_TYPE_FILE &&
+	    type != YAFFS_OBJECT_TYPE_FILE) {
+		yaffs_FreeTnodeTree(in->myDev, in->variant.fileVariant.top,
+				    in->variant.fileVariant.topLevel);
+		in->variant.fileVariant.top = NULL;
+	}
+	in->variantType = type;
+}
+
 static int yaffs_Scan(yaffs_Device *dev)
 {
 	yaffs_ExtendedTags tags;
@@ -5829,7 +6049,7 @@ static int yaffs_Scan(yaffs_Device *dev)
 				     tags.objectId == YAFFS_OBJECTID_LOSTNFOUND)) {
 					/* We only load some info, don't fiddle with directory structure */
 					in->valid = 1;
-					in->variantType = oh->type;
+					yaffs_SetScannedObjectType(in, oh->type);
 
 					in->yst_mode = oh->yst_mode;
 #ifdef CONFIG_YAFFS_WINCE
@@ -5854,7 +6074,7 @@ static int yaffs_Scan(yaffs_Device *dev)
 					/* we need to load this info */
 
 					in->valid = 1;
-					in->variantType = oh->type;
+					yaffs_SetScannedObjectType(in, oh->type);
 
 					in->yst_mode = oh->yst_mode;
 #ifdef CONFIG_YAFFS_WINCE
@@ -6118,6 +6338,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
+	yaffs_ExtendedTags *blockTags = NULL;
 
 	if (!dev->isYaffs2) {
 		T(YAFFS_TRACE_SCAN,
@@ -6146,6 +6367,19 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 		return YAFFS_FAIL;
 	}
 
+	/* Tags for a whole block are read in one go */
+	blockTags = YMALLOC(dev->nChunksPerBlock * sizeof(yaffs_ExtendedTags));
+
+	if (!blockTags) {
+		T(YAFFS_TRACE_SCAN,
+		  (TSTR("yaffs_Scan() could not allocate block tags!" TENDSTR)));
+		if (altBlockIndex)
+			YFREE_ALT(blockIndex);
+		else
+			YFREE(blockIndex);
+		return YAFFS_FAIL;
+	}
+
 	dev->blocksInCheckpoint = 0;
 
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
@@ -6265,6 +6499,18 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		/* Top the tnode pool up in one go to what a block can need
+		 * at worst, a level 0 tnode per chunk, rather than a hundred
+		 * at a time as the chunks are added.
+		 */
+		if (dev->nFreeTnodes < dev->nChunksPerBlock)
+			yaffs_CreateTnodes(dev,
+				dev->nChunksPerBlock - dev->nFreeTnodes);
+
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
+		    state == YAFFS_BLOCK_STATE_ALLOCATING)
+			yaffs_ReadBlockTagsFromNAND(dev, blk, blockTags);
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->nChunksPerBlock - 1;
@@ -6277,8 +6523,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			tags = blockTags[c];
 
 			/* Let's have a good look at this chunk... */
 
@@ -6528,7 +6773,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 					in->valid = 1;
 
 					if (oh) {
-						in->variantType = oh->type;
+						yaffs_SetScannedObjectType(in, oh->type);
 
 						in->yst_mode = oh->yst_mode;
 #ifdef CONFIG_YAFFS_WINCE
@@ -6548,7 +6793,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 #endif
 					} else {
-						in->variantType = tags.extraObjectType;
+						yaffs_SetScannedObjectType(in,
+							tags.extraObjectType);
 						in->lazyLoaded = 1;
 					}
 
@@ -6561,7 +6807,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 					in->hdrChunk = chunk;
 
 					if (oh) {
-						in->variantType = oh->type;
+						yaffs_SetScannedObjectType(in, oh->type);
 
 						in->yst_mode = oh->yst_mode;
 #ifdef CONFIG_YAFFS_WINCE
@@ -6598,7 +6844,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 						 equivalentObjectId = oh->equivalentObjectId;
 
 					} else {
-						in->variantType = tags.extraObjectType;
+						yaffs_SetScannedObjectType(in,
+							tags.extraObjectType);
 						parent =
 						    yaffs_FindOrCreateObjectByNumber
 							(dev, tags.extraParentObjectId,
@@ -6732,6 +6979,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	else
 		YFREE(blockIndex);
 
+	YFREE(blockTags);
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
@@ -6739,6 +6988,10 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	 */
 	yaffs_HardlinkFixup(dev, hardList);
 
+#ifdef __KERNEL__
+	/* Don't keep the tnodes left over from the last top-up pinned */
+	yaffs_ShrinkTnodes(dev, dev->nFreeTnodes);
+#endif
 
 	yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
 
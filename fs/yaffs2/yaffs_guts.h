@@ -58,6 +58,9 @@
 #define YAFFS_ALLOCATION_NTNODES	100
 #define YAFFS_ALLOCATION_NLINKS		100
 
+/* Number of checkpoint chunks read ahead in one request */
+#define YAFFS_CHECKPOINT_PREFETCH_CHUNKS	8
+
 #define YAFFS_NOBJECT_BUCKETS		256
 
 
@@ -590,6 +593,15 @@ struct yaffs_DeviceStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+
+	/* Optional: read nChunks consecutive chunks (within one block) in a
+	 * single request. data may be NULL to read only the tags. Returning
+	 * YAFFS_FAIL makes YAFFS fall back to chunk-at-a-time reads.
+	 */
+	int (*readChunksWithTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+					   int chunkInNAND, int nChunks,
+					   __u8 *data,
+					   yaffs_ExtendedTags *tags);
 #endif
 
 	int isYaffs2;
@@ -641,10 +653,15 @@ struct yaffs_DeviceStruct {
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 
+				 */
+	__u8 *blockSpareBuffer;	/* For mtdif2 multi-chunk reads: the spare
+				 * bytes for every chunk in a block.
 				 */
 	void (*putSuperFunc) (struct super_block *sb);
         struct ylist_head searchContexts;
 
+	struct kmem_cache *tnodeCache;	/* Tnodes are allocated from here */
+
 #endif
 
 	int isMounted;
@@ -671,6 +688,10 @@ struct yaffs_DeviceStruct {
 	int checkpointNextBlock;
 	int *checkpointBlockList;
 	int checkpointMaxBlocks;
+	__u8 *checkpointPrefetchBuffer;	/* Chunks read ahead during restore */
+	yaffs_ExtendedTags *checkpointPrefetchTags;
+	int checkpointPrefetchFirst;
+	int checkpointPrefetchCount;
 	__u32 checkpointSum;
 	__u32 checkpointXor;
 
@@ -893,6 +914,8 @@ void yfsd_WinFileTimeNow(__u32 target[2]);
 #ifdef __KERNEL__
 
 void yaffs_HandleDeferedFree(yaffs_Object *obj);
+int yaffs_ShrinkTnodes(yaffs_Device *dev, int nToFree);
+void yaffs_DestroyTnodeCaches(void);
 #endif
 
 /* Debug dump  */
@@ -187,6 +187,65 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/* Read a run of chunks from one block with a single MTD request.
+ * The spare areas come back packed (oobavail bytes per page) in
+ * blockSpareBuffer. Uncorrectable ECC errors are not attributed to a
+ * chunk here, so on those we fail and let the caller retry chunk by
+ * chunk. Corrected bitflips are fine: the data is good, and flagging the
+ * first chunk is enough to get the block prioritised for gc.
+ */
+int nandmtd2_ReadChunksWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
+					int nChunks, __u8 *data,
+					yaffs_ExtendedTags *tags)
+{
+#if (MTD_VERSION_CODE > MTD_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	int retval;
+	int i;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->totalBytesPerChunk;
+
+	yaffs_PackedTags2 pt;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR
+	   ("nandmtd2_ReadChunksWithTagsFromNAND chunk %d n %d data %p tags %p"
+	    TENDSTR), chunkInNAND, nChunks, data, tags));
+
+	if (dev->inbandTags || !tags || !dev->blockSpareBuffer ||
+	    nChunks < 1 || nChunks > dev->nChunksPerBlock)
+		return YAFFS_FAIL;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = nChunks * mtd->oobavail;
+	ops.len = data ? nChunks * dev->nDataBytesPerChunk : 0;
+	ops.ooboffs = 0;
+	ops.datbuf = data;
+	ops.oobbuf = dev->blockSpareBuffer;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	if (retval != 0 && retval != -EUCLEAN)
+		return YAFFS_FAIL;
+
+	for (i = 0; i < nChunks; i++) {
+		memcpy(&pt, &dev->blockSpareBuffer[i * mtd->oobavail],
+			sizeof(pt));
+		yaffs_UnpackTags2(&tags[i], &pt);
+	}
+
+	if (retval == -EUCLEAN) {
+		if (tags[0].eccResult == YAFFS_ECC_RESULT_NO_ERROR)
+			tags[0].eccResult = YAFFS_ECC_RESULT_FIXED;
+		dev->eccFixed++;
+	}
+
+	return YAFFS_OK;
+#else
+	return YAFFS_FAIL;
+#endif
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
@@ -53,6 +53,37 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 	return result;
 }
 
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+					yaffs_ExtendedTags *tags)
+{
+	int i;
+	int firstChunk = blockInNAND * dev->nChunksPerBlock;
+	yaffs_BlockInfo *bi;
+
+	if (dev->readChunksWithTagsFromNAND &&
+	    dev->readChunksWithTagsFromNAND(dev,
+					    firstChunk - dev->chunkOffset,
+					    dev->nChunksPerBlock, NULL,
+					    tags) == YAFFS_OK) {
+		dev->nPageReads += dev->nChunksPerBlock;
+
+		for (i = 0; i < dev->nChunksPerBlock; i++) {
+			if (tags[i].eccResult > YAFFS_ECC_RESULT_NO_ERROR) {
+				bi = yaffs_GetBlockInfo(dev, blockInNAND);
+				yaffs_HandleChunkError(dev, bi);
+			}
+		}
+		return YAFFS_OK;
+	}
+
+	/* No multi-chunk read support (or it failed): one chunk at a time */
+	for (i = 0; i < dev->nChunksPerBlock; i++)
+		yaffs_ReadChunkWithTagsFromNAND(dev, firstChunk + i, NULL,
+						&tags[i]);
+
+	return YAFFS_OK;
+}
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   int chunkInNAND,
 						   const __u8 *buffer,
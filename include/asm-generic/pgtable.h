@@ -204,6 +204,53 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+
+/* Only ever called on a pmd_trans_huge() pmd */
+static inline int pmd_write(pmd_t pmd)
+{
+	return 0;
+}
+
+static inline int pmdp_test_and_clear_young(struct vm_area_struct *vma,
+					    unsigned long address,
+					    pmd_t *pmdp)
+{
+	return 0;
+}
+
+static inline int pmdp_clear_flush_young(struct vm_area_struct *vma,
+					 unsigned long address,
+					 pmd_t *pmdp)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Like pmd_none_or_clear_bad(), but leaves a transparent huge pmd alone:
+ * huge pmds look "bad" to the pte walkers, and may be installed by a
+ * concurrent fault holding mmap_sem only for reading.
+ */
+static inline int pmd_none_or_trans_huge_or_clear_bad(pmd_t *pmd)
+{
+	pmd_t pmdval = *pmd;
+
+	barrier();
+	if (pmd_none(pmdval))
+		return 1;
+	if (unlikely(pmd_bad(pmdval))) {
+		if (!pmd_trans_huge(pmdval))
+			pmd_clear_bad(pmd);
+		return 1;
+	}
+	return 0;
+}
+
 static inline pte_t __ptep_modify_prot_start(struct mm_struct *mm,
 					     unsigned long addr,
 					     pte_t *ptep)
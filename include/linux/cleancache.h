@@ -0,0 +1,111 @@
+#ifndef _LINUX_CLEANCACHE_H
+#define _LINUX_CLEANCACHE_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+/*
+ * cleancache gives clean page cache pages a second chance: when one is
+ * evicted it is offered to a backend, which may keep a copy somewhere
+ * the kernel cannot address directly (compressed in RAM, in hypervisor
+ * memory, ...), and the next read of the page asks the backend before
+ * going to disk.  The backend may drop anything it holds at any time,
+ * so a put is only a hint and a get may always fail.
+ *
+ * Filesystems opt in per superblock with cleancache_init_fs(); pages
+ * are keyed by pool, inode number and page index, so the filesystem
+ * must have stable inode numbers and must not change the data on disk
+ * behind the page cache's back.
+ */
+struct cleancache_ops {
+	int (*init_fs)(size_t pagesize);
+	int (*get_page)(int pool, ino_t ino, pgoff_t index, struct page *page);
+	void (*put_page)(int pool, ino_t ino, pgoff_t index, struct page *page);
+	void (*flush_page)(int pool, ino_t ino, pgoff_t index);
+	void (*flush_inode)(int pool, ino_t ino);
+	void (*flush_fs)(int pool);
+};
+
+#ifdef CONFIG_CLEANCACHE
+extern int cleancache_enabled;
+
+extern int cleancache_register_ops(struct cleancache_ops *ops);
+extern void __cleancache_init_fs(struct super_block *sb);
+extern int __cleancache_get_page(struct page *page);
+extern void __cleancache_put_page(struct page *page);
+extern void __cleancache_flush_page(struct address_space *mapping,
+				    struct page *page);
+extern void __cleancache_flush_inode(struct address_space *mapping);
+extern void __cleancache_flush_fs(struct super_block *sb);
+
+static inline void cleancache_init_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_init_fs(sb);
+}
+
+/*
+ * Returns 0 if the page was filled from cleancache.  The page must be
+ * locked and not uptodate.
+ */
+static inline int cleancache_get_page(struct page *page)
+{
+	if (cleancache_enabled)
+		return __cleancache_get_page(page);
+	return -1;
+}
+
+/* The page must be locked, clean, uptodate and about to leave the cache */
+static inline void cleancache_put_page(struct page *page)
+{
+	if (cleancache_enabled)
+		__cleancache_put_page(page);
+}
+
+static inline void cleancache_flush_page(struct address_space *mapping,
+					 struct page *page)
+{
+	if (cleancache_enabled)
+		__cleancache_flush_page(mapping, page);
+}
+
+static inline void cleancache_flush_inode(struct address_space *mapping)
+{
+	if (cleancache_enabled)
+		__cleancache_flush_inode(mapping);
+}
+
+static inline void cleancache_flush_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_flush_fs(sb);
+}
+#else
+static inline void cleancache_init_fs(struct super_block *sb)
+{
+}
+
+static inline int cleancache_get_page(struct page *page)
+{
+	return -1;
+}
+
+static inline void cleancache_put_page(struct page *page)
+{
+}
+
+static inline void cleancache_flush_page(struct address_space *mapping,
+					 struct page *page)
+{
+}
+
+static inline void cleancache_flush_inode(struct address_space *mapping)
+{
+}
+
+static inline void cleancache_flush_fs(struct super_block *sb)
+{
+}
+#endif /* CONFIG_CLEANCACHE */
+
+#endif /* _LINUX_CLEANCACHE_H */
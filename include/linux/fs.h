@@ -1380,6 +1380,9 @@ struct super_block {
 	 * generic_show_options()
 	 */
 	char *s_options;
+
+	/* cleancache pool of the filesystem, -1 if it does not use one */
+	int cleancache_poolid;
 };
 
 extern struct timespec current_fs_time(struct super_block *sb);
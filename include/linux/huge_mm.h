@@ -0,0 +1,97 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * A huge pmd maps HPAGE_PMD_NR naturally aligned order-0 pages, each
+ * of them refcounted, mapcounted and on the LRU exactly as if it were
+ * mapped by a pte: only the page table level differs.  Splitting a huge
+ * pmd thus never touches the pages, it just hands them over to a pte
+ * table preallocated when the huge pmd was established.
+ */
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      unsigned int flags);
+extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+					  unsigned long address,
+					  pmd_t *pmd,
+					  unsigned int flags);
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+};
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define HPAGE_PMD_SHIFT PMD_SHIFT
+#define HPAGE_PMD_SIZE	((1UL) << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER (HPAGE_PMD_SHIFT-PAGE_SHIFT)
+#define HPAGE_PMD_NR	(1<<HPAGE_PMD_ORDER)
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * Whether the sysfs policy and the vma's madvise state allow huge pages
+ * in @vma: the vma type itself is checked by the callers.
+ */
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return 0;
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return 1;
+	return test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags) &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+extern void __split_huge_page_pmd(struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd);
+#define split_huge_page_pmd(__vma, __address, __pmd)			\
+	do {								\
+		pmd_t *____pmd = (__pmd);				\
+		if (unlikely(pmd_trans_huge(*____pmd)))			\
+			__split_huge_page_pmd(__vma, __address, ____pmd); \
+	} while (0)
+extern void split_huge_page_address(struct vm_area_struct *vma,
+				    unsigned long address);
+extern pmd_t *page_check_address_pmd(struct page *page,
+				     struct mm_struct *mm,
+				     unsigned long address);
+extern void mark_huge_pmd_referenced(struct page *page, pmd_t *pmd);
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+
+#else /* CONFIG_TRANSPARENT_HUGEPAGE */
+#define transparent_hugepage_enabled(__vma) 0
+
+#define split_huge_page_pmd(__vma, __address, __pmd)	\
+	do { } while (0)
+static inline void split_huge_page_address(struct vm_area_struct *vma,
+					   unsigned long address)
+{
+}
+static inline pmd_t *page_check_address_pmd(struct page *page,
+					    struct mm_struct *mm,
+					    unsigned long address)
+{
+	return NULL;
+}
+static inline void mark_huge_pmd_referenced(struct page *page, pmd_t *pmd)
+{
+}
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
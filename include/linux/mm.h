@@ -96,7 +96,11 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_NORESERVE	0x00200000	/* should the VM suppress accounting */
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
+#ifdef CONFIG_MMU
+#define VM_HUGEPAGE	0x01000000	/* MADV_HUGEPAGE marked this vma */
+#else
 #define VM_MAPPED_COPY	0x01000000	/* T if mapped copy of data (nommu mmap) */
+#endif
 #define VM_INSERTPAGE	0x02000000	/* The vma has had "vm_insert_page()" done on it */
 #define VM_ALWAYSDUMP	0x04000000	/* Always include in core dumps */
 
@@ -105,6 +109,10 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_SAO		0x20000000	/* Strong Access Ordering (powerpc) */
 #define VM_PFN_AT_MMAP	0x40000000	/* PFNMAP vma that is fully mapped at mmap time */
 #define VM_MERGEABLE	0x80000000	/* KSM may merge identical pages */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* Only 64bit has room for this one: THP depends on it */
+#define VM_NOHUGEPAGE	0x100000000UL	/* MADV_NOHUGEPAGE marked this vma */
+#endif
 
 #ifndef VM_STACK_DEFAULT_FLAGS		/* arch can override this */
 #define VM_STACK_DEFAULT_FLAGS VM_DATA_DEFAULT_FLAGS
@@ -332,6 +340,7 @@ void put_page(struct page *page);
 void put_pages_list(struct list_head *pages);
 
 void split_page(struct page *page, unsigned int order);
+int split_free_page(struct page *page);
 
 /*
  * Compound pages have a destructor function.  Provide a
@@ -699,9 +708,13 @@ static inline int page_mapped(struct page *page)
 
 #define VM_FAULT_NOPAGE	0x0100	/* ->fault installed the pte, not return page */
 #define VM_FAULT_LOCKED	0x0200	/* ->fault locked the returned page */
+#define VM_FAULT_FALLBACK 0x0400	/* huge page fault failed, fall back to small */
+#define VM_FAULT_RETRY	0x0800	/* speculative fault failed, retry under mmap_sem */
 
 #define VM_FAULT_ERROR	(VM_FAULT_OOM | VM_FAULT_SIGBUS | VM_FAULT_HWPOISON)
 
+#include <linux/huge_mm.h>
+
 /*
  * Can be called by the pagefault handler when it gets a VM_FAULT_OOM.
  */
@@ -816,6 +829,63 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags);
+
+/*
+ * Changes to the vmas of an mm, or to the page tables they map, which
+ * a fault without mmap_sem could miss, are made between these.  Writers
+ * are serialized by mmap_sem held for write, or by page_table_lock when
+ * expanding a stack under mmap_sem held for read, so they may sleep in
+ * between.  They nest: a longer change, like moving a vma for mremap,
+ * keeps the count odd across all the shorter changes it is made of.
+ */
+static inline void mmap_seq_write_begin(struct mm_struct *mm)
+{
+	if (!mm->mmap_seq_nesting++)
+		write_seqcount_begin(&mm->mmap_seq);
+}
+
+static inline void mmap_seq_write_end(struct mm_struct *mm)
+{
+	if (!--mm->mmap_seq_nesting)
+		write_seqcount_end(&mm->mmap_seq);
+}
+
+/*
+ * The count for a fault without mmap_sem to check against.  It is odd
+ * while the vmas are being changed: the fault should then give up and
+ * take mmap_sem rather than wait, the change may take a while.
+ */
+static inline unsigned mmap_seq_read_begin(struct mm_struct *mm)
+{
+	unsigned seq = ACCESS_ONCE(mm->mmap_seq.sequence);
+
+	smp_rmb();
+	return seq;
+}
+
+static inline int mmap_seq_read_retry(struct mm_struct *mm, unsigned seq)
+{
+	return read_seqcount_retry(&mm->mmap_seq, seq);
+}
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags)
+{
+	return VM_FAULT_RETRY;
+}
+
+static inline void mmap_seq_write_begin(struct mm_struct *mm)
+{
+}
+
+static inline void mmap_seq_write_end(struct mm_struct *mm)
+{
+}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 
@@ -9,6 +9,8 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
@@ -180,6 +182,12 @@ struct vm_area_struct {
 	void * vm_private_data;		/* was vm_pte (shared mem) */
 	unsigned long vm_truncate_count;/* truncate_count or restart_addr */
 
+#ifdef CONFIG_SWAP
+	atomic_long_t swap_readahead_info; /* swap readahead window and hits */
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	struct rcu_head vm_rcu_head;	/* freed after speculative lookups */
+#endif
 #ifndef CONFIG_MMU
 	struct vm_region *vm_region;	/* NOMMU mapping region */
 #endif
@@ -216,6 +224,10 @@ struct mm_struct {
 	atomic_t mm_count;			/* How many references to "struct mm_struct" (users count as 1) */
 	int map_count;				/* number of VMAs */
 	struct rw_semaphore mmap_sem;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t mmap_seq;			/* Bumped by changes to the VMAs, for faults without mmap_sem */
+	int mmap_seq_nesting;			/* Depth of mmap_seq_write_begin() */
+#endif
 	spinlock_t page_table_lock;		/* Protects page tables and some counters */
 
 	struct list_head mmlist;		/* List of maybe swapped mm's.	These are globally strung
@@ -287,6 +299,17 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_FUTEX
+	/* private futex hash, allocated on first use, see kernel/futex.c */
+	struct futex_hash *futex_hash;
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/*
+	 * Page tables preallocated for the huge pmds of this mm, used when
+	 * they are split: protected by page_table_lock.
+	 */
+	struct page *pmd_huge_pte;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
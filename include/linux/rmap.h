@@ -26,6 +26,15 @@
  */
 struct anon_vma {
 	spinlock_t lock;	/* Serialize access to vma list */
+#ifdef CONFIG_MIGRATION
+	/*
+	 * Page migration may unmap pages without holding the mmap_sem of
+	 * any of the vmas, so the last vma can go away while the pages are
+	 * still to be remapped.  Migration holds a reference meanwhile and
+	 * the anon_vma is freed by whoever drops the last one.
+	 */
+	atomic_t migrate_refcount;
+#endif
 	/*
 	 * NOTE: the LSB of the head.next is set by
 	 * mm_take_all_locks() _after_ taking the above lock. So the
@@ -38,6 +47,41 @@ struct anon_vma {
 };
 
 #ifdef CONFIG_MMU
+#ifdef CONFIG_MIGRATION
+static inline void migrate_refcount_init(struct anon_vma *anon_vma)
+{
+	atomic_set(&anon_vma->migrate_refcount, 0);
+}
+
+static inline int migrate_refcount(struct anon_vma *anon_vma)
+{
+	return atomic_read(&anon_vma->migrate_refcount);
+}
+
+static inline void get_anon_vma(struct anon_vma *anon_vma)
+{
+	atomic_inc(&anon_vma->migrate_refcount);
+}
+
+void drop_anon_vma(struct anon_vma *anon_vma);
+#else
+static inline void migrate_refcount_init(struct anon_vma *anon_vma)
+{
+}
+
+static inline int migrate_refcount(struct anon_vma *anon_vma)
+{
+	return 0;
+}
+#endif /* CONFIG_MIGRATION */
+
+static inline struct anon_vma *page_anon_vma(struct page *page)
+{
+	if (!PageAnon(page))
+		return NULL;
+	return (struct anon_vma *)
+		((unsigned long)page->mapping - PAGE_MAPPING_ANON);
+}
 
 static inline void anon_vma_lock(struct vm_area_struct *vma)
 {
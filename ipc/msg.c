@@ -61,6 +61,7 @@ struct msg_receiver {
 struct msg_sender {
 	struct list_head	list;
 	struct task_struct	*tsk;
+	size_t			msgsz;
 };
 
 #define SEARCH_ANY		1
@@ -223,9 +224,17 @@ static int newque(struct ipc_namespace *ns, struct ipc_params *params)
 	return msq->q_perm.id;
 }
 
-static inline void ss_add(struct msg_queue *msq, struct msg_sender *mss)
+static inline int msg_fits_inqueue(struct msg_queue *msq, size_t msgsz)
+{
+	return msgsz + msq->q_cbytes <= msq->q_qbytes &&
+		1 + msq->q_qnum <= msq->q_qbytes;
+}
+
+static inline void ss_add(struct msg_queue *msq, struct msg_sender *mss,
+			  size_t msgsz)
 {
 	mss->tsk = current;
+	mss->msgsz = msgsz;
 	current->state = TASK_INTERRUPTIBLE;
 	list_add_tail(&mss->list, &msq->q_senders);
 }
@@ -236,35 +245,50 @@ static inline void ss_del(struct msg_sender *mss)
 		list_del(&mss->list);
 }
 
-static void ss_wakeup(struct list_head *h, int kill)
+/*
+ * Queue the sleeping senders for wakeup.  Unless the queue is going
+ * away, only those whose message now fits are woken; the others are
+ * moved to the tail on their behalf, which keeps the wakeup order.
+ */
+static void ss_wakeup(struct msg_queue *msq, struct wake_q_head *wake_q,
+		      int kill)
 {
-	struct list_head *tmp;
-
-	tmp = h->next;
-	while (tmp != h) {
-		struct msg_sender *mss;
+	struct msg_sender *mss, *t;
+	struct task_struct *stop_tsk = NULL;
 
-		mss = list_entry(tmp, struct msg_sender, list);
-		tmp = tmp->next;
+	list_for_each_entry_safe(mss, t, &msq->q_senders, list) {
 		if (kill)
 			mss->list.next = NULL;
-		wake_up_process(mss->tsk);
+		/*
+		 * Stop at the first sender we moved: we have already been
+		 * through the whole original list.
+		 */
+		else if (stop_tsk == mss->tsk)
+			break;
+		else if (!msg_fits_inqueue(msq, mss->msgsz)) {
+			if (!stop_tsk)
+				stop_tsk = mss->tsk;
+			list_move_tail(&mss->list, &msq->q_senders);
+			continue;
+		}
+
+		wake_q_add(wake_q, mss->tsk);
 	}
 }
 
-static void expunge_all(struct msg_queue *msq, int res)
+/*
+ * Hand @res to all the sleeping receivers.  They can pick it up without
+ * taking the queue lock as soon as r_msg changes, the wakeups are issued
+ * by the caller once it has dropped the lock.
+ */
+static void expunge_all(struct msg_queue *msq, int res,
+			struct wake_q_head *wake_q)
 {
-	struct list_head *tmp;
-
-	tmp = msq->q_receivers.next;
-	while (tmp != &msq->q_receivers) {
-		struct msg_receiver *msr;
+	struct msg_receiver *msr, *t;
 
-		msr = list_entry(tmp, struct msg_receiver, r_list);
-		tmp = tmp->next;
-		msr->r_msg = NULL;
-		wake_up_process(msr->r_tsk);
-		smp_mb();
+	list_for_each_entry_safe(msr, t, &msq->q_receivers, r_list) {
+		/* wake_q_add() implies the barrier that orders this store */
+		wake_q_add(wake_q, msr->r_tsk);
 		msr->r_msg = ERR_PTR(res);
 	}
 }
@@ -281,11 +305,13 @@ static void freeque(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 {
 	struct list_head *tmp;
 	struct msg_queue *msq = container_of(ipcp, struct msg_queue, q_perm);
+	WAKE_Q(wake_q);
 
-	expunge_all(msq, -EIDRM);
-	ss_wakeup(&msq->q_senders, 1);
+	expunge_all(msq, -EIDRM, &wake_q);
+	ss_wakeup(msq, &wake_q, 1);
 	msg_rmid(ns, msq);
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 
 	tmp = msq->q_messages.next;
 	while (tmp != &msq->q_messages) {
@@ -416,6 +442,7 @@ static int msgctl_down(struct ipc_namespace *ns, int msqid, int cmd,
 	struct msqid64_ds msqid64;
 	struct msg_queue *msq;
 	int err;
+	WAKE_Q(wake_q);
 
 	if (cmd == IPC_SET) {
 		if (copy_msqid_from_user(&msqid64, buf, version))
@@ -451,17 +478,18 @@ static int msgctl_down(struct ipc_namespace *ns, int msqid, int cmd,
 		/* sleeping receivers might be excluded by
 		 * stricter permissions.
 		 */
-		expunge_all(msq, -EAGAIN);
+		expunge_all(msq, -EAGAIN, &wake_q);
 		/* sleeping senders might be able to send
 		 * due to a larger queue size.
 		 */
-		ss_wakeup(&msq->q_senders, 0);
+		ss_wakeup(msq, &wake_q, 0);
 		break;
 	default:
 		err = -EINVAL;
 	}
 out_unlock:
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 out_up:
 	up_write(&msg_ids(ns).rw_mutex);
 	return err;
@@ -598,32 +626,35 @@ static int testmsg(struct msg_msg *msg, long type, int mode)
 	return 0;
 }
 
-static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg)
+/*
+ * Hand @msg directly to a sleeping receiver instead of queueing it.
+ * The receiver is only queued for wakeup here, the caller wakes it
+ * after dropping the queue lock; it can pick up r_msg without ever
+ * taking the lock again.
+ */
+static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg,
+				 struct wake_q_head *wake_q)
 {
-	struct list_head *tmp;
+	struct msg_receiver *msr, *t;
 
-	tmp = msq->q_receivers.next;
-	while (tmp != &msq->q_receivers) {
-		struct msg_receiver *msr;
-
-		msr = list_entry(tmp, struct msg_receiver, r_list);
-		tmp = tmp->next;
+	list_for_each_entry_safe(msr, t, &msq->q_receivers, r_list) {
 		if (testmsg(msg, msr->r_msgtype, msr->r_mode) &&
 		    !security_msg_queue_msgrcv(msq, msg, msr->r_tsk,
 					       msr->r_msgtype, msr->r_mode)) {
 
 			list_del(&msr->r_list);
+			/*
+			 * wake_q_add() implies the barrier that orders the
+			 * list_del() (and the message contents) before the
+			 * store to r_msg the receiver polls for.
+			 */
 			if (msr->r_maxsize < msg->m_ts) {
-				msr->r_msg = NULL;
-				wake_up_process(msr->r_tsk);
-				smp_mb();
+				wake_q_add(wake_q, msr->r_tsk);
 				msr->r_msg = ERR_PTR(-E2BIG);
 			} else {
-				msr->r_msg = NULL;
 				msq->q_lrpid = task_pid_vnr(msr->r_tsk);
 				msq->q_rtime = get_seconds();
-				wake_up_process(msr->r_tsk);
-				smp_mb();
+				wake_q_add(wake_q, msr->r_tsk);
 				msr->r_msg = msg;
 
 				return 1;
@@ -633,6 +664,11 @@ static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg)
 	return 0;
 }
 
+/*
+ * The queue lock covers the message list, the lists of sleeping senders
+ * and receivers, and the counts.  Messages are copied from and to user
+ * space (load_msg, store_msg), and sleepers are woken, outside of it.
+ */
 long do_msgsnd(int msqid, long mtype, void __user *mtext,
 		size_t msgsz, int msgflg)
 {
@@ -640,6 +676,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	struct msg_msg *msg;
 	int err;
 	struct ipc_namespace *ns;
+	WAKE_Q(wake_q);
 
 	ns = current->nsproxy->ipc_ns;
 
@@ -672,17 +709,15 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 		if (err)
 			goto out_unlock_free;
 
-		if (msgsz + msq->q_cbytes <= msq->q_qbytes &&
-				1 + msq->q_qnum <= msq->q_qbytes) {
+		if (msg_fits_inqueue(msq, msgsz))
 			break;
-		}
 
 		/* queue full, wait: */
 		if (msgflg & IPC_NOWAIT) {
 			err = -EAGAIN;
 			goto out_unlock_free;
 		}
-		ss_add(msq, &s);
+		ss_add(msq, &s, msgsz);
 		ipc_rcu_getref(msq);
 		msg_unlock(msq);
 		schedule();
@@ -704,7 +739,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	msq->q_lspid = task_tgid_vnr(current);
 	msq->q_stime = get_seconds();
 
-	if (!pipelined_send(msq, msg)) {
+	if (!pipelined_send(msq, msg, &wake_q)) {
 		/* noone is waiting for this message, enqueue it */
 		list_add_tail(&msg->m_list, &msq->q_messages);
 		msq->q_cbytes += msgsz;
@@ -718,6 +753,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 
 out_unlock_free:
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 out_free:
 	if (msg != NULL)
 		free_msg(msg);
@@ -760,6 +796,7 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 	struct msg_msg *msg;
 	int mode;
 	struct ipc_namespace *ns;
+	WAKE_Q(wake_q);
 
 	if (msqid < 0 || (long) msgsz < 0)
 		return -EINVAL;
@@ -816,8 +853,9 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 			msq->q_cbytes -= msg->m_ts;
 			atomic_sub(msg->m_ts, &ns->msg_bytes);
 			atomic_dec(&ns->msg_hdrs);
-			ss_wakeup(&msq->q_senders, 0);
+			ss_wakeup(msq, &wake_q, 0);
 			msg_unlock(msq);
+			wake_up_q(&wake_q);
 			break;
 		}
 		/* No message waiting. Wait for a message */
@@ -852,20 +890,13 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 		rcu_read_lock();
 
 		/* Lockless receive, part 2:
-		 * Wait until pipelined_send or expunge_all are outside of
-		 * wake_up_process(). There is a race with exit(), see
-		 * ipc/mqueue.c for the details.
-		 */
-		msg = (struct msg_msg*)msr_d.r_msg;
-		while (msg == NULL) {
-			cpu_relax();
-			msg = (struct msg_msg *)msr_d.r_msg;
-		}
-
-		/* Lockless receive, part 3:
-		 * If there is a message or an error then accept it without
-		 * locking.
+		 * pipelined_send and expunge_all set r_msg under the queue
+		 * lock and only wake us up once they have dropped it, holding
+		 * a reference on our task meanwhile: as soon as r_msg is
+		 * not -EAGAIN anymore, nobody touches msr_d again.  If there
+		 * is a message or an error then accept it without locking.
 		 */
+		msg = (struct msg_msg *)msr_d.r_msg;
 		if (msg != ERR_PTR(-EAGAIN)) {
 			rcu_read_unlock();
 			break;
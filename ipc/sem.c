@@ -106,8 +106,17 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *	sem_undo.id_next,
  *	sem_array.sem_pending{,last},
  *	sem_array.sem_undo: sem_lock() for read/write
+ *	sem.sem_pending: sem.lock or sem_lock() for read/write
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
- *	
+ *
+ * Locking:
+ * semtimedop() with a single sop on an array without pending multi-sop
+ * operations only takes the spinlock of the semaphore it operates on.
+ * Everything else takes the array spinlock and then waits for all the
+ * per-semaphore lock holders to drop out, see sem_lock_ops().  Single-sop
+ * operations sleep on the queue of their semaphore, multi-sop ones on
+ * the queue of the array, counted in sem_array.complex_count: while that
+ * is non-zero, every semop takes the array lock.
  */
 
 #define sc_semmsl	sem_ctls[0]
@@ -141,37 +150,127 @@ void __init sem_init (void)
 				IPC_SEM_IDS, sysvipc_sem_proc_show);
 }
 
+/*
+ * Wait until all currently ongoing single-sop operations have completed.
+ * Called with the array lock held: new ones back off in sem_lock_ops()
+ * as long as it is.
+ */
+static void sem_wait_array(struct sem_array *sma)
+{
+	int i;
+
+	/* Pairs with the smp_mb() in sem_lock_ops() */
+	smp_mb();
+	for (i = 0; i < sma->sem_nsems; i++)
+		spin_unlock_wait(&sma->sem_base[i].lock);
+}
+
 /*
  * sem_lock_(check_) routines are called in the paths where the rw_mutex
- * is not held.
+ * is not held.  They lock the whole array.
  */
 static inline struct sem_array *sem_lock(struct ipc_namespace *ns, int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock(&sem_ids(ns), id);
+	struct sem_array *sma;
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
 
-	return container_of(ipcp, struct sem_array, sem_perm);
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
 }
 
 static inline struct sem_array *sem_lock_check(struct ipc_namespace *ns,
 						int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock_check(&sem_ids(ns), id);
+	struct sem_array *sma;
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
 
-	return container_of(ipcp, struct sem_array, sem_perm);
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
 }
 
 static inline void sem_lock_and_putref(struct sem_array *sma)
 {
 	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_wait_array(sma);
 	ipc_rcu_putref(sma);
 }
 
+/*
+ * Look up a semaphore array without locking it, for semtimedop().
+ * Called with rcu_read_lock() held.
+ */
+static inline struct sem_array *sem_obtain_object_check(struct ipc_namespace *ns,
+							int id)
+{
+	struct kern_ipc_perm *ipcp = ipc_obtain_object_check(&sem_ids(ns), id);
+
+	if (IS_ERR(ipcp))
+		return (struct sem_array *)ipcp;
+
+	return container_of(ipcp, struct sem_array, sem_perm);
+}
+
+/*
+ * Lock what @nsops operations @sops on @sma need: the semaphore itself
+ * for a single sop on an array without pending multi-sop operations,
+ * the whole array otherwise.  Returns the number of the semaphore that
+ * was locked, -1 for the array.
+ *
+ * Called with rcu_read_lock() held; the caller has to check
+ * sma->sem_perm.deleted once the lock is taken.
+ */
+static int sem_lock_ops(struct sem_array *sma, struct sembuf *sops, int nsops)
+{
+	struct sem *sem;
+
+again:
+	if (nsops == 1 && !sma->complex_count) {
+		sem = sma->sem_base + sops->sem_num;
+		spin_lock(&sem->lock);
+
+		/*
+		 * Our lock must be visible before we look at the array lock,
+		 * pairs with the smp_mb() in sem_wait_array().
+		 */
+		smp_mb();
+		if (unlikely(spin_is_locked(&sma->sem_perm.lock))) {
+			spin_unlock(&sem->lock);
+			spin_unlock_wait(&sma->sem_perm.lock);
+			goto again;
+		}
+
+		/*
+		 * A multi-sop operation may have been queued before the
+		 * array lock was dropped: it could be affected by us.
+		 */
+		smp_rmb();
+		if (likely(!sma->complex_count))
+			return sops->sem_num;
+
+		spin_unlock(&sem->lock);
+	}
+
+	spin_lock(&sma->sem_perm.lock);
+	sem_wait_array(sma);
+	return -1;
+}
+
+static inline void sem_unlock_ops(struct sem_array *sma, int locknum)
+{
+	if (locknum == -1)
+		spin_unlock(&sma->sem_perm.lock);
+	else
+		spin_unlock(&sma->sem_base[locknum].lock);
+}
+
 static inline void sem_getref_and_unlock(struct sem_array *sma)
 {
 	ipc_rcu_getref(sma);
@@ -195,7 +294,7 @@ static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
  * Without the check/retry algorithm a lockless wakeup is possible:
  * - queue.status is initialized to -EINTR before blocking.
  * - wakeup is performed by
- *	* unlinking the queue entry from sma->sem_pending
+ *	* unlinking the queue entry from its pending queue
  *	* setting queue.status to IN_WAKEUP
  *	  This is the notification for the blocked thread that a
  *	  result value is imminent.
@@ -238,6 +337,7 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 	int retval;
 	struct sem_array *sma;
 	int size;
+	int i;
 	key_t key = params->key;
 	int nsems = params->u.nsems;
 	int semflg = params->flg;
@@ -264,6 +364,20 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 		return retval;
 	}
 
+	/*
+	 * semtimedop() looks at the semaphores without taking the array
+	 * lock, so they have to be set up before the array becomes visible.
+	 */
+	sma->sem_base = (struct sem *) &sma[1];
+	for (i = 0; i < nsems; i++) {
+		spin_lock_init(&sma->sem_base[i].lock);
+		INIT_LIST_HEAD(&sma->sem_base[i].sem_pending);
+	}
+	INIT_LIST_HEAD(&sma->sem_pending);
+	INIT_LIST_HEAD(&sma->list_id);
+	sma->sem_nsems = nsems;
+	sma->sem_ctime = get_seconds();
+
 	id = ipc_addid(&sem_ids(ns), &sma->sem_perm, ns->sc_semmni);
 	if (id < 0) {
 		security_sem_free(sma);
@@ -272,11 +386,6 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 	}
 	ns->used_sems += nsems;
 
-	sma->sem_base = (struct sem *) &sma[1];
-	INIT_LIST_HEAD(&sma->sem_pending);
-	INIT_LIST_HEAD(&sma->list_id);
-	sma->sem_nsems = nsems;
-	sma->sem_ctime = get_seconds();
 	sem_unlock(sma);
 
 	return sma->sem_perm.id;
@@ -398,63 +507,100 @@ undo:
 	return result;
 }
 
-/* Go through the pending queue for the indicated semaphore
- * looking for tasks that can be completed.
+static void wake_up_sem_queue(struct sem_queue *q, int error)
+{
+	q->status = IN_WAKEUP;
+	wake_up_process(q->sleeper);
+	/* hands-off: q will disappear immediately after
+	 * writing q->status.
+	 */
+	smp_wmb();
+	q->status = error;
+}
+
+static void unlink_queue(struct sem_array *sma, struct sem_queue *q)
+{
+	list_del(&q->list);
+	if (q->nsops > 1)
+		sma->complex_count--;
+}
+
+/* Go through the pending queue for the indicated semaphore (or the
+ * multi-sop queue of the array if semnum is -1) looking for tasks that
+ * can be completed.  Returns 1 if an operation that altered the array
+ * was completed.
  */
-static void update_queue (struct sem_array * sma)
+static int update_queue(struct sem_array *sma, int semnum)
 {
-	int error;
-	struct sem_queue * q;
+	struct list_head *pending_list;
+	struct sem_queue *q, *n;
+	int error, alter, altered = 0;
+
+	if (semnum == -1)
+		pending_list = &sma->sem_pending;
+	else
+		pending_list = &sma->sem_base[semnum].sem_pending;
+
+again:
+	list_for_each_entry_safe(q, n, pending_list, list) {
+		/*
+		 * The only single-sop operations that sleep are decrements
+		 * and wait-for-zero, the latter queued at the head: once we
+		 * get to the decrements of a zero semaphore we're done.
+		 */
+		if (semnum != -1 && q->alter &&
+		    sma->sem_base[semnum].semval == 0)
+			break;
 
-	q = list_entry(sma->sem_pending.next, struct sem_queue, list);
-	while (&q->list != &sma->sem_pending) {
 		error = try_atomic_semop(sma, q->sops, q->nsops,
 					 q->undo, q->pid);
 
 		/* Does q->sleeper still need to sleep? */
-		if (error <= 0) {
-			struct sem_queue *n;
+		if (error > 0)
+			continue;
 
-			/*
-			 * Continue scanning. The next operation
-			 * that must be checked depends on the type of the
-			 * completed operation:
-			 * - if the operation modified the array, then
-			 *   restart from the head of the queue and
-			 *   check for threads that might be waiting
-			 *   for semaphore values to become 0.
-			 * - if the operation didn't modify the array,
-			 *   then just continue.
-			 * The order of list_del() and reading ->next
-			 * is crucial: In the former case, the list_del()
-			 * must be done first [because we might be the
-			 * first entry in ->sem_pending], in the latter
-			 * case the list_del() must be done last
-			 * [because the list is invalid after the list_del()]
-			 */
-			if (q->alter) {
-				list_del(&q->list);
-				n = list_entry(sma->sem_pending.next,
-						struct sem_queue, list);
-			} else {
-				n = list_entry(q->list.next, struct sem_queue,
-						list);
-				list_del(&q->list);
-			}
+		alter = q->alter;
+		unlink_queue(sma, q);
+		wake_up_sem_queue(q, error);
+
+		/*
+		 * If the operation modified the array, restart from the
+		 * head of the queue and check for threads that might be
+		 * waiting for semaphore values to become 0.
+		 */
+		if (alter && !error) {
+			altered = 1;
+			goto again;
+		}
+	}
+	return altered;
+}
 
-			/* wake up the waiting thread */
-			q->status = IN_WAKEUP;
+/*
+ * Wake up the sleepers that the operations @sops just performed on @sma
+ * may have unblocked; @sops is NULL if any semaphore may have changed.
+ * With only single-sop operations pending, it is enough to look at the
+ * queues of the semaphores that were altered.  Otherwise the array lock
+ * is held and all queues are rescanned until nothing more completes, as
+ * whatever a multi-sop operation does may unblock any other one.
+ */
+static void do_smart_update(struct sem_array *sma, struct sembuf *sops,
+			    int nsops)
+{
+	int i, progress;
+
+	if (sma->complex_count || !sops) {
+		do {
+			progress = update_queue(sma, -1);
+			for (i = 0; i < sma->sem_nsems; i++)
+				progress |= update_queue(sma, i);
+		} while (progress);
+		return;
+	}
 
-			wake_up_process(q->sleeper);
-			/* hands-off: q will disappear immediately after
-			 * writing q->status.
-			 */
-			smp_wmb();
-			q->status = error;
-			q = n;
-		} else {
-			q = list_entry(q->list.next, struct sem_queue, list);
-		}
+	for (i = 0; i < nsops; i++) {
+		if (sops[i].sem_op)
+			update_queue(sma, sops[i].sem_num);
 	}
 }
 
@@ -473,6 +619,11 @@ static int count_semncnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semncnt = 0;
+	list_for_each_entry(q, &sma->sem_base[semnum].sem_pending, list) {
+		struct sembuf * sop = q->sops;
+		if ((sop->sem_op < 0) && !(sop->sem_flg & IPC_NOWAIT))
+			semncnt++;
+	}
 	list_for_each_entry(q, &sma->sem_pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -492,6 +643,11 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semzcnt = 0;
+	list_for_each_entry(q, &sma->sem_base[semnum].sem_pending, list) {
+		struct sembuf * sop = q->sops;
+		if ((sop->sem_op == 0) && !(sop->sem_flg & IPC_NOWAIT))
+			semzcnt++;
+	}
 	list_for_each_entry(q, &sma->sem_pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -520,9 +676,11 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	struct sem_undo *un, *tu;
 	struct sem_queue *q, *tq;
 	struct sem_array *sma = container_of(ipcp, struct sem_array, sem_perm);
+	int i;
 
 	/* Free the existing undo structures for this semaphore set.  */
 	assert_spin_locked(&sma->sem_perm.lock);
+	sem_wait_array(sma);
 	list_for_each_entry_safe(un, tu, &sma->list_id, list_id) {
 		list_del(&un->list_id);
 		spin_lock(&un->ulp->lock);
@@ -534,12 +692,16 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 
 	/* Wake up all pending processes and let them fail with EIDRM. */
 	list_for_each_entry_safe(q, tq, &sma->sem_pending, list) {
-		list_del(&q->list);
+		unlink_queue(sma, q);
+		wake_up_sem_queue(q, -EIDRM);
+	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		struct sem *sem = sma->sem_base + i;
 
-		q->status = IN_WAKEUP;
-		wake_up_process(q->sleeper); /* doesn't sleep */
-		smp_wmb();
-		q->status = -EIDRM;	/* hands-off q */
+		list_for_each_entry_safe(q, tq, &sem->sem_pending, list) {
+			unlink_queue(sma, q);
+			wake_up_sem_queue(q, -EIDRM);
+		}
 	}
 
 	/* Remove the semaphore set from the IDR */
@@ -760,7 +922,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		}
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -802,7 +964,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		curr->sempid = task_tgid_vnr(current);
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -1068,6 +1230,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
+	int locknum;
 
 	ns = current->nsproxy->ipc_ns;
 
@@ -1107,64 +1270,60 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 			alter = 1;
 	}
 
+	/*
+	 * find_alloc_undo() returns with rcu_read_lock() held, which keeps
+	 * "un" around until we have the semaphore locked: it can then only
+	 * go away through IPC_RMID, which we check for below, or through
+	 * exit_sem(), which always operates on current (or a dead task).
+	 */
 	if (undos) {
 		un = find_alloc_undo(ns, semid);
 		if (IS_ERR(un)) {
 			error = PTR_ERR(un);
 			goto out_free;
 		}
-	} else
+	} else {
 		un = NULL;
+		rcu_read_lock();
+	}
 
-	sma = sem_lock_check(ns, semid);
+	sma = sem_obtain_object_check(ns, semid);
 	if (IS_ERR(sma)) {
-		if (un)
-			rcu_read_unlock();
 		error = PTR_ERR(sma);
-		goto out_free;
-	}
-
-	/*
-	 * semid identifiers are not unique - find_alloc_undo may have
-	 * allocated an undo structure, it was invalidated by an RMID
-	 * and now a new array with received the same id. Check and fail.
-	 * This case can be detected checking un->semid. The existance of
-	 * "un" itself is guaranteed by rcu.
-	 */
-	error = -EIDRM;
-	if (un) {
-		if (un->semid == -1) {
-			rcu_read_unlock();
-			goto out_unlock_free;
-		} else {
-			/*
-			 * rcu lock can be released, "un" cannot disappear:
-			 * - sem_lock is acquired, thus IPC_RMID is
-			 *   impossible.
-			 * - exit_sem is impossible, it always operates on
-			 *   current (or a dead task).
-			 */
-
-			rcu_read_unlock();
-		}
+		goto out_rcu;
 	}
 
 	error = -EFBIG;
 	if (max >= sma->sem_nsems)
-		goto out_unlock_free;
+		goto out_rcu;
 
 	error = -EACCES;
 	if (ipcperms(&sma->sem_perm, alter ? S_IWUGO : S_IRUGO))
-		goto out_unlock_free;
+		goto out_rcu;
 
 	error = security_sem_semop(sma, sops, nsops, alter);
 	if (error)
+		goto out_rcu;
+
+	locknum = sem_lock_ops(sma, sops, nsops);
+
+	/*
+	 * The array may have been removed while we were not holding any
+	 * lock.  semid identifiers are not unique either - find_alloc_undo
+	 * may have allocated an undo structure, it was invalidated by an
+	 * RMID and now a new array with received the same id.  This case
+	 * can be detected checking un->semid.  Fail in both cases.
+	 */
+	error = -EIDRM;
+	if (sma->sem_perm.deleted)
+		goto out_unlock_free;
+	if (un && un->semid == -1)
 		goto out_unlock_free;
 
 	error = try_atomic_semop (sma, sops, nsops, un, task_tgid_vnr(current));
 	if (error <= 0) {
 		if (alter && error == 0)
-			update_queue (sma);
+			do_smart_update(sma, sops, nsops);
 		goto out_unlock_free;
 	}
 
@@ -1177,15 +1336,26 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
-	if (alter)
-		list_add_tail(&queue.list, &sma->sem_pending);
-	else
-		list_add(&queue.list, &sma->sem_pending);
+	if (nsops == 1) {
+		struct sem *curr = &sma->sem_base[sops->sem_num];
+
+		if (alter)
+			list_add_tail(&queue.list, &curr->sem_pending);
+		else
+			list_add(&queue.list, &curr->sem_pending);
+	} else {
+		if (alter)
+			list_add_tail(&queue.list, &sma->sem_pending);
+		else
+			list_add(&queue.list, &sma->sem_pending);
+		sma->complex_count++;
+	}
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
 	current->state = TASK_INTERRUPTIBLE;
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
+	rcu_read_unlock();
 
 	if (timeout)
 		jiffies_left = schedule_timeout(jiffies_left);
@@ -1204,10 +1374,21 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		goto out_free;
 	}
 
-	sma = sem_lock(ns, semid);
+	/*
+	 * If the array is gone, or its id was reused, IPC_RMID has
+	 * already taken us off the queue.
+	 */
+	rcu_read_lock();
+	sma = sem_obtain_object_check(ns, semid);
 	if (IS_ERR(sma)) {
 		error = -EIDRM;
-		goto out_free;
+		goto out_rcu;
+	}
+
+	locknum = sem_lock_ops(sma, sops, nsops);
+	if (sma->sem_perm.deleted) {
+		error = -EIDRM;
+		goto out_unlock_free;
 	}
 
 	/*
@@ -1223,10 +1404,12 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	 */
 	if (timeout && jiffies_left == 0)
 		error = -EAGAIN;
-	list_del(&queue.list);
+	unlink_queue(sma, &queue);
 
 out_unlock_free:
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
+out_rcu:
+	rcu_read_unlock();
 out_free:
 	if(sops != fast_sops)
 		kfree(sops);
@@ -1352,7 +1535,7 @@ void exit_sem(struct task_struct *tsk)
 		}
 		sma->sem_otime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		sem_unlock(sma);
 
 		call_rcu(&un->rcu, free_un);
@@ -59,6 +59,8 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +68,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Priority Inheritance state:
  */
@@ -130,19 +130,107 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Shared futexes are hashed into a global table sized by the number of
+ * possible cpus.  Process private futexes go into a smaller table owned
+ * by the mm, so that unrelated processes never contend on (or walk the
+ * chains of) each other's buckets.
+ */
+struct futex_hash {
+	unsigned long mask;
+	struct futex_hash_bucket *queues;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+static struct futex_hash futex_global_hash __read_mostly;
+static unsigned long futex_private_hashsize __read_mostly;
+
+static void futex_hash_init_queues(struct futex_hash *fh, unsigned long size)
+{
+	unsigned long i;
+
+	fh->mask = size - 1;
+	for (i = 0; i < size; i++) {
+		plist_head_init(&fh->queues[i].chain, &fh->queues[i].lock);
+		spin_lock_init(&fh->queues[i].lock);
+	}
+}
+
+/*
+ * Allocate the private futex hash of @mm.  This is done the first time
+ * the process enters the futex code with a private futex, i.e. on its
+ * first contended futex, so that processes which never contend pay
+ * nothing.  If the allocation fails the mm falls back to the global
+ * table for good: all users of a key have to agree on its bucket.
+ */
+static void futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_hash *fh;
+
+	fh = kmalloc(sizeof(*fh), GFP_KERNEL);
+	if (fh) {
+		fh->queues = kmalloc(futex_private_hashsize *
+				     sizeof(struct futex_hash_bucket),
+				     GFP_KERNEL);
+		if (fh->queues) {
+			futex_hash_init_queues(fh, futex_private_hashsize);
+		} else {
+			kfree(fh);
+			fh = NULL;
+		}
+	}
+	if (!fh)
+		fh = &futex_global_hash;
+
+	spin_lock(&mm->page_table_lock);
+	if (!mm->futex_hash) {
+		/* Initialized buckets before the pointer, see hash_futex() */
+		smp_wmb();
+		mm->futex_hash = fh;
+		fh = NULL;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	if (fh && fh != &futex_global_hash) {
+		kfree(fh->queues);
+		kfree(fh);
+	}
+}
+
+/*
+ * Called from __mmdrop(): nobody can be queued on a private futex of
+ * an mm without holding a reference to it.
+ */
+void futex_mm_free(struct mm_struct *mm)
+{
+	struct futex_hash *fh = mm->futex_hash;
+
+	if (fh && fh != &futex_global_hash) {
+		kfree(fh->queues);
+		kfree(fh);
+	}
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_hash *fh = &futex_global_hash;
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	/*
+	 * get_futex_key() has set up the private hash of the mm before
+	 * handing out the first private key for it.
+	 */
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		fh = ACCESS_ONCE(key->private.mm->futex_hash);
+		smp_read_barrier_depends();
+	}
+	return &fh->queues[hash & fh->mask];
 }
 
 /*
@@ -240,6 +328,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key)
 	if (!fshared) {
 		if (unlikely(!access_ok(VERIFY_WRITE, uaddr, sizeof(u32))))
 			return -EFAULT;
+		if (unlikely(!mm->futex_hash))
+			futex_private_hash_alloc(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);
@@ -769,21 +859,21 @@ retry:
 
 /*
  * The hash bucket lock must be held when this is called.
- * Afterwards, the futex_q must not be accessed.
+ * Afterwards, the futex_q must not be accessed.  Callers must ensure
+ * to later call wake_up_q() for the actual wakeups to occur, after
+ * dropping the hash bucket lock, so that the woken tasks don't bounce
+ * straight back on it.
  */
-static void wake_futex(struct futex_q *q)
+static void mark_wake_futex(struct wake_q_head *wake_q, struct futex_q *q)
 {
 	struct task_struct *p = q->task;
 
 	/*
-	 * We set q->lock_ptr = NULL _before_ we wake up the task. If
-	 * a non futex wake up happens on another CPU then the task
-	 * might exit and p would dereference a non existing task
-	 * struct. Prevent this by holding a reference on p across the
-	 * wake up.
+	 * Queue the task before clearing q->lock_ptr: the wake-queue holds
+	 * a reference on p, so even a non futex wake up followed by the
+	 * task exiting cannot free it under us.
 	 */
-	get_task_struct(p);
-
+	wake_q_add(wake_q, p);
 	plist_del(&q->list, &q->list.plist);
 	/*
 	 * The waiting task can free the futex_q as soon as
@@ -793,9 +883,6 @@ static void wake_futex(struct futex_q *q)
 	 */
 	smp_wmb();
 	q->lock_ptr = NULL;
-
-	wake_up_state(p, TASK_NORMAL);
-	put_task_struct(p);
 }
 
 static int wake_futex_pi(u32 __user *uaddr, u32 uval, struct futex_q *this)
@@ -917,6 +1004,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 	struct plist_head *head;
 	union futex_key key = FUTEX_KEY_INIT;
 	int ret;
+	WAKE_Q(wake_q);
 
 	if (!bitset)
 		return -EINVAL;
@@ -940,13 +1028,14 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 			if (!(this->bitset & bitset))
 				continue;
 
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			if (++ret >= nr_wake)
 				break;
 		}
 	}
 
 	spin_unlock(&hb->lock);
+	wake_up_q(&wake_q);
 	put_futex_key(fshared, &key);
 out:
 	return ret;
@@ -965,6 +1054,7 @@ futex_wake_op(u32 __user *uaddr1, int fshared, u32 __user *uaddr2,
 	struct plist_head *head;
 	struct futex_q *this, *next;
 	int ret, op_ret;
+	WAKE_Q(wake_q);
 
 retry:
 	ret = get_futex_key(uaddr1, fshared, &key1);
@@ -1014,7 +1104,7 @@ retry_private:
 
 	plist_for_each_entry_safe(this, next, head, list) {
 		if (match_futex (&this->key, &key1)) {
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			if (++ret >= nr_wake)
 				break;
 		}
@@ -1026,7 +1116,7 @@ retry_private:
 		op_ret = 0;
 		plist_for_each_entry_safe(this, next, head, list) {
 			if (match_futex (&this->key, &key2)) {
-				wake_futex(this);
+				mark_wake_futex(&wake_q, this);
 				if (++op_ret >= nr_wake2)
 					break;
 			}
@@ -1035,6 +1125,7 @@ retry_private:
 	}
 
 	double_unlock_hb(hb1, hb2);
+	wake_up_q(&wake_q);
 out_put_keys:
 	put_futex_key(fshared, &key2);
 out_put_key1:
@@ -1197,6 +1288,7 @@ static int futex_requeue(u32 __user *uaddr1, int fshared, u32 __user *uaddr2,
 	struct plist_head *head1;
 	struct futex_q *this, *next;
 	u32 curval2;
+	WAKE_Q(wake_q);
 
 	if (requeue_pi) {
 		/*
@@ -1340,7 +1432,7 @@ retry_private:
 		 * woken by futex_unlock_pi().
 		 */
 		if (++task_count <= nr_wake && !requeue_pi) {
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			continue;
 		}
 
@@ -1379,6 +1471,7 @@ retry_private:
 
 out_unlock:
 	double_unlock_hb(hb1, hb2);
+	wake_up_q(&wake_q);
 
 	/*
 	 * drop_futex_key_refs() must be called outside the spinlocks. During
@@ -2678,8 +2771,9 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned long hashsize;
+	unsigned int hashbits;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2695,10 +2789,19 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	hashsize = 16;
+	futex_private_hashsize = 16;
+#else
+	hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	futex_private_hashsize =
+		roundup_pow_of_two(max(16U, 4 * num_possible_cpus()));
+#endif
+
+	futex_global_hash.queues =
+		alloc_large_system_hash("futex", sizeof(struct futex_hash_bucket),
+					hashsize, 0, 0, &hashbits, NULL, hashsize);
+	futex_hash_init_queues(&futex_global_hash, 1UL << hashbits);
 
 	return 0;
 }
@@ -614,6 +614,7 @@ static void update_curr_rt(struct rq *rq)
 
 	curr->se.exec_start = rq->clock;
 	cpuacct_charge(curr, delta_exec);
+	rt_runtime_account(rq, curr, delta_exec);
 
 	sched_rt_avg_update(rq, delta_exec);
 
@@ -889,6 +890,8 @@ static void enqueue_task_rt(struct rq *rq, struct task_struct *p, int wakeup)
 
 	if (!task_current(rq, p) && p->rt.nr_cpus_allowed > 1)
 		enqueue_pushable_task(rq, p);
+
+	inc_nr_running(rq);
 }
 
 static void dequeue_task_rt(struct rq *rq, struct task_struct *p, int sleep)
@@ -899,6 +902,8 @@ static void dequeue_task_rt(struct rq *rq, struct task_struct *p, int sleep)
 	dequeue_rt_entity(rt_se);
 
 	dequeue_pushable_task(rq, p);
+
+	dec_nr_running(rq);
 }
 
 /*
@@ -4,7 +4,18 @@
  * bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 16
+
+static void show_lat_hist(struct seq_file *seq, const char *name,
+			  unsigned int *count)
+{
+	int i;
+
+	seq_printf(seq, "%s", name);
+	for (i = 0; i < SCHED_LAT_BUCKETS; i++)
+		seq_printf(seq, " %u", count[i]);
+	seq_printf(seq, "\n");
+}
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
@@ -35,6 +46,12 @@ static int show_schedstat(struct seq_file *seq, void *v)
 
 		seq_printf(seq, "\n");
 
+		/* wakeup-to-run latency histograms */
+		show_lat_hist(seq, "latency fair",
+			      rq->lat_hist.count[SCHED_LAT_FAIR]);
+		show_lat_hist(seq, "latency rt",
+			      rq->lat_hist.count[SCHED_LAT_RT]);
+
 #ifdef CONFIG_SMP
 		/* domain-specific stats */
 		preempt_disable();
@@ -132,6 +149,65 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 	if (rq)
 		rq->rq_sched_info.run_delay += delta;
 }
+#ifdef CONFIG_CGROUP_SCHED
+/* The statistics go to the cpu cgroup of @p, autogroups don't count. */
+static inline struct sched_group_stats *
+task_group_stats(struct task_struct *p, struct rq *rq)
+{
+	struct task_group *tg;
+
+	tg = container_of(task_subsys_state(p, cpu_cgroup_subsys_id),
+			  struct task_group, css);
+	return per_cpu_ptr(tg->stats, cpu_of(rq));
+}
+#endif
+
+static inline int sched_lat_bucket(u64 delta)
+{
+	delta >>= 10;
+	if (delta >= 1ULL << (SCHED_LAT_BUCKETS - 2))
+		return SCHED_LAT_BUCKETS - 1;
+	return fls((u32)delta);
+}
+
+/*
+ * Called when @p is picked to run on @rq.  If @p was woken up since it
+ * last ran, account the time it took to get here.  Expects runqueue
+ * lock to be held for atomicity of update.
+ */
+static inline void sched_latency_arrive(struct rq *rq, struct task_struct *p)
+{
+	s64 delta;
+	int class, bucket;
+
+	if (!p->se.wakeup_start)
+		return;
+
+	delta = rq->clock - p->se.wakeup_start;
+	p->se.wakeup_start = 0;
+	if (delta < 0)
+		delta = 0;
+
+	class = rt_task(p) ? SCHED_LAT_RT : SCHED_LAT_FAIR;
+	bucket = sched_lat_bucket(delta);
+
+	rq->lat_hist.count[class][bucket]++;
+#ifdef CONFIG_CGROUP_SCHED
+	task_group_stats(p, rq)->lat_hist.count[class][bucket]++;
+#endif
+}
+
+/*
+ * Expects runqueue lock to be held for atomicity of update
+ */
+static inline void
+rt_runtime_account(struct rq *rq, struct task_struct *p, u64 delta)
+{
+#ifdef CONFIG_CGROUP_SCHED
+	task_group_stats(p, rq)->rt_runtime += delta;
+#endif
+}
+
 # define schedstat_inc(rq, field)	do { (rq)->field++; } while (0)
 # define schedstat_add(rq, field, amt)	do { (rq)->field += (amt); } while (0)
 # define schedstat_set(var, val)	do { var = (val); } while (0)
@@ -145,6 +221,12 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 static inline void
 rq_sched_info_depart(struct rq *rq, unsigned long long delta)
 {}
+static inline void
+sched_latency_arrive(struct rq *rq, struct task_struct *p)
+{}
+static inline void
+rt_runtime_account(struct rq *rq, struct task_struct *p, u64 delta)
+{}
 # define schedstat_inc(rq, field)	do { } while (0)
 # define schedstat_add(rq, field, amt)	do { } while (0)
 # define schedstat_set(var, val)	do { } while (0)
@@ -1,6 +1,7 @@
 /* Copyright 2008, 2005 Rusty Russell rusty@rustcorp.com.au IBM Corporation.
  * GPL v2 and any later version.
  */
+#include <linux/completion.h>
 #include <linux/cpu.h>
 #include <linux/err.h>
 #include <linux/kthread.h>
@@ -38,14 +39,16 @@ struct stop_machine_data {
 static unsigned int num_threads;
 static atomic_t thread_ack;
 static DEFINE_MUTEX(lock);
-/* setup_lock protects refcount, stop_machine_wq and stop_machine_work. */
+/* setup_lock protects refcount and the per-cpu stop_machine threads. */
 static DEFINE_MUTEX(setup_lock);
 /* Users of stop_machine. */
 static int refcount;
-static struct workqueue_struct *stop_machine_wq;
+static DEFINE_PER_CPU(struct task_struct *, stop_machine_thread);
+static DEFINE_PER_CPU(int, stop_machine_kick);
+static atomic_t threads_active;
+static DECLARE_COMPLETION(threads_done);
 static struct stop_machine_data active, idle;
 static const struct cpumask *active_cpus;
-static void *stop_machine_work;
 
 static void set_state(enum stopmachine_state newstate)
 {
@@ -63,8 +66,8 @@ static void ack_state(void)
 }
 
 /* This is the actual function which stops the CPU. It runs
- * in the context of a dedicated stopmachine workqueue. */
-static void stop_cpu(struct work_struct *unused)
+ * in the context of a dedicated per-cpu stopmachine thread. */
+static void stop_cpu(void)
 {
 	enum stopmachine_state curstate = STOPMACHINE_NONE;
 	struct stop_machine_data *smdata = &idle;
@@ -112,46 +115,110 @@ static int chill(void *unused)
 	return 0;
 }
 
+/*
+ * The stopmachine threads run at the highest RT priority so that
+ * nothing else gets to run on a cpu once it has been kicked.  They
+ * used to be the workers of an RT workqueue, but workqueues share
+ * their workers now and those don't run with RT priority.
+ */
+static int stop_machine_cpu_thread(void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	while (true) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!per_cpu(stop_machine_kick, cpu)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		per_cpu(stop_machine_kick, cpu) = 0;
+
+		stop_cpu();
+		if (atomic_dec_and_test(&threads_active))
+			complete(&threads_done);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int create_stop_machine_thread(unsigned int cpu)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	struct task_struct *p;
+
+	p = kthread_create(stop_machine_cpu_thread, (void *)(unsigned long)cpu,
+			   "kstop/%u", cpu);
+	if (IS_ERR(p))
+		return PTR_ERR(p);
+	sched_setscheduler_nocheck(p, SCHED_FIFO, &param);
+	kthread_bind(p, cpu);
+	per_cpu(stop_machine_thread, cpu) = p;
+	return 0;
+}
+
+static void destroy_stop_machine_thread(unsigned int cpu)
+{
+	struct task_struct *p = per_cpu(stop_machine_thread, cpu);
+
+	if (p) {
+		kthread_stop(p);
+		per_cpu(stop_machine_thread, cpu) = NULL;
+	}
+}
+
 int stop_machine_create(void)
 {
+	unsigned int cpu;
+	int err = 0;
+
+	get_online_cpus();
 	mutex_lock(&setup_lock);
 	if (refcount)
 		goto done;
-	stop_machine_wq = create_rt_workqueue("kstop");
-	if (!stop_machine_wq)
-		goto err_out;
-	stop_machine_work = alloc_percpu(struct work_struct);
-	if (!stop_machine_work)
-		goto err_out;
+	for_each_online_cpu(cpu) {
+		err = create_stop_machine_thread(cpu);
+		if (err)
+			goto err_out;
+	}
+	for_each_online_cpu(cpu)
+		wake_up_process(per_cpu(stop_machine_thread, cpu));
 done:
 	refcount++;
 	mutex_unlock(&setup_lock);
+	put_online_cpus();
 	return 0;
 
 err_out:
-	if (stop_machine_wq)
-		destroy_workqueue(stop_machine_wq);
+	for_each_possible_cpu(cpu)
+		destroy_stop_machine_thread(cpu);
 	mutex_unlock(&setup_lock);
-	return -ENOMEM;
+	put_online_cpus();
+	return err;
 }
 EXPORT_SYMBOL_GPL(stop_machine_create);
 
 void stop_machine_destroy(void)
 {
+	unsigned int cpu;
+
+	get_online_cpus();
 	mutex_lock(&setup_lock);
 	refcount--;
 	if (refcount)
 		goto done;
-	destroy_workqueue(stop_machine_wq);
-	free_percpu(stop_machine_work);
+	for_each_possible_cpu(cpu)
+		destroy_stop_machine_thread(cpu);
 done:
 	mutex_unlock(&setup_lock);
+	put_online_cpus();
 }
 EXPORT_SYMBOL_GPL(stop_machine_destroy);
 
 int __stop_machine(int (*fn)(void *), void *data, const struct cpumask *cpus)
 {
-	struct work_struct *sm_work;
 	int i, ret;
 
 	/* Set up initial state. */
@@ -165,18 +232,19 @@ int __stop_machine(int (*fn)(void *), void *data, const struct cpumask *cpus)
 	idle.data = NULL;
 
 	set_state(STOPMACHINE_PREPARE);
+	atomic_set(&threads_active, num_threads);
+	INIT_COMPLETION(threads_done);
 
-	/* Schedule the stop_cpu work on all cpus: hold this CPU so one
+	/* Kick the stop_machine thread on all cpus: hold this CPU so one
 	 * doesn't hit this CPU until we're ready. */
 	get_cpu();
 	for_each_online_cpu(i) {
-		sm_work = per_cpu_ptr(stop_machine_work, i);
-		INIT_WORK(sm_work, stop_cpu);
-		queue_work_on(i, stop_machine_wq, sm_work);
+		per_cpu(stop_machine_kick, i) = 1;
+		wake_up_process(per_cpu(stop_machine_thread, i));
 	}
 	/* This will release the thread on our CPU. */
 	put_cpu();
-	flush_workqueue(stop_machine_wq);
+	wait_for_completion(&threads_done);
 	ret = active.fnret;
 	mutex_unlock(&lock);
 	return ret;
@@ -197,3 +265,42 @@ int stop_machine(int (*fn)(void *), void *data, const struct cpumask *cpus)
 	return ret;
 }
 EXPORT_SYMBOL_GPL(stop_machine);
+
+/*
+ * Keep a stopmachine thread on every online cpu while there are
+ * users, the hotplug code itself being one of them.
+ */
+static int __cpuinit stop_machine_cpu_callback(struct notifier_block *nfb,
+					       unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+	int ret = NOTIFY_OK;
+
+	mutex_lock(&setup_lock);
+	if (!refcount)
+		goto out;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_UP_PREPARE:
+		if (create_stop_machine_thread(cpu))
+			ret = NOTIFY_BAD;
+		break;
+	case CPU_ONLINE:
+		wake_up_process(per_cpu(stop_machine_thread, cpu));
+		break;
+	case CPU_UP_CANCELED:
+	case CPU_POST_DEAD:
+		destroy_stop_machine_thread(cpu);
+		break;
+	}
+out:
+	mutex_unlock(&setup_lock);
+	return ret;
+}
+
+static int __init stop_machine_init(void)
+{
+	hotcpu_notifier(stop_machine_cpu_callback, 0);
+	return 0;
+}
+early_initcall(stop_machine_init);
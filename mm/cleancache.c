@@ -0,0 +1,174 @@
+/*
+ * mm/cleancache.c - second chance cache for clean page cache pages
+ *
+ * The front end between the page cache and a cleancache backend, see
+ * include/linux/cleancache.h and Documentation/vm/cleancache.txt.
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/cleancache.h>
+
+/*
+ * Set once a backend has registered; until then every hook is a single
+ * test of this flag.  Filesystems mounted before that keep running
+ * without cleancache.
+ */
+int cleancache_enabled __read_mostly;
+EXPORT_SYMBOL(cleancache_enabled);
+
+static struct cleancache_ops *cleancache_ops __read_mostly;
+
+/* Statistics, racy but only ever looked at by humans */
+static unsigned long cleancache_succ_gets;
+static unsigned long cleancache_failed_gets;
+static unsigned long cleancache_puts;
+static unsigned long cleancache_flushes;
+
+/**
+ * cleancache_register_ops - register a cleancache backend
+ * @ops: the backend's operations
+ *
+ * Only one backend can be registered, and it cannot go away again.
+ * Returns 0 on success, -EBUSY if a backend is already registered.
+ */
+int cleancache_register_ops(struct cleancache_ops *ops)
+{
+	if (cmpxchg(&cleancache_ops, NULL, ops))
+		return -EBUSY;
+	smp_wmb();
+	cleancache_enabled = 1;
+	return 0;
+}
+EXPORT_SYMBOL(cleancache_register_ops);
+
+/*
+ * Called by a filesystem at mount time to opt in.  A negative pool id
+ * means the backend could not set up a pool and the superblock does not
+ * use cleancache.
+ */
+void __cleancache_init_fs(struct super_block *sb)
+{
+	sb->cleancache_poolid = cleancache_ops->init_fs(PAGE_SIZE);
+}
+EXPORT_SYMBOL(__cleancache_init_fs);
+
+int __cleancache_get_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	int pool = inode->i_sb->cleancache_poolid;
+	int ret = -1;
+
+	VM_BUG_ON(!PageLocked(page));
+	if (pool >= 0) {
+		ret = cleancache_ops->get_page(pool, inode->i_ino,
+					       page->index, page);
+		if (ret == 0)
+			cleancache_succ_gets++;
+		else
+			cleancache_failed_gets++;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__cleancache_get_page);
+
+/*
+ * Called from __remove_from_page_cache() under mapping->tree_lock with
+ * interrupts disabled, so the backend must not sleep.
+ */
+void __cleancache_put_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	int pool = inode->i_sb->cleancache_poolid;
+
+	VM_BUG_ON(!PageLocked(page));
+	if (pool >= 0) {
+		cleancache_ops->put_page(pool, inode->i_ino, page->index, page);
+		cleancache_puts++;
+	}
+}
+EXPORT_SYMBOL(__cleancache_put_page);
+
+void __cleancache_flush_page(struct address_space *mapping, struct page *page)
+{
+	struct inode *inode = mapping->host;
+	int pool = inode->i_sb->cleancache_poolid;
+
+	if (pool >= 0) {
+		cleancache_ops->flush_page(pool, inode->i_ino, page->index);
+		cleancache_flushes++;
+	}
+}
+EXPORT_SYMBOL(__cleancache_flush_page);
+
+void __cleancache_flush_inode(struct address_space *mapping)
+{
+	struct inode *inode = mapping->host;
+	int pool = inode->i_sb->cleancache_poolid;
+
+	if (pool >= 0)
+		cleancache_ops->flush_inode(pool, inode->i_ino);
+}
+EXPORT_SYMBOL(__cleancache_flush_inode);
+
+/*
+ * Called at unmount before the filesystem is shut down; pages evicted
+ * while it is are no longer offered to the backend.
+ */
+void __cleancache_flush_fs(struct super_block *sb)
+{
+	int pool = sb->cleancache_poolid;
+
+	if (pool >= 0) {
+		sb->cleancache_poolid = -1;
+		cleancache_ops->flush_fs(pool);
+	}
+}
+EXPORT_SYMBOL(__cleancache_flush_fs);
+
+#ifdef CONFIG_SYSFS
+
+#define CLEANCACHE_ATTR_RO(_name)					\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%lu\n", cleancache_##_name);		\
+}									\
+static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+
+CLEANCACHE_ATTR_RO(succ_gets);
+CLEANCACHE_ATTR_RO(failed_gets);
+CLEANCACHE_ATTR_RO(puts);
+CLEANCACHE_ATTR_RO(flushes);
+
+static struct attribute *cleancache_attrs[] = {
+	&succ_gets_attr.attr,
+	&failed_gets_attr.attr,
+	&puts_attr.attr,
+	&flushes_attr.attr,
+	NULL,
+};
+
+static struct attribute_group cleancache_attr_group = {
+	.attrs = cleancache_attrs,
+	.name = "cleancache",
+};
+
+static int __init cleancache_init(void)
+{
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &cleancache_attr_group);
+	if (err)
+		printk(KERN_ERR "cleancache: register sysfs failed\n");
+	return err;
+}
+module_init(cleancache_init)
+
+#endif /* CONFIG_SYSFS */
@@ -34,6 +34,7 @@
 #include <linux/hardirq.h> /* for BUG_ON(!in_atomic()) only */
 #include <linux/memcontrol.h>
 #include <linux/mm_inline.h> /* for page_is_file_cache() */
+#include <linux/cleancache.h>
 #include "internal.h"
 
 /*
@@ -119,6 +120,16 @@ void __remove_from_page_cache(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 
+	/*
+	 * Give a clean copy of the page a second chance in cleancache.
+	 * Anything else makes whatever copy cleancache holds stale, so
+	 * drop it: no page may come back from there once ours is gone.
+	 */
+	if (PageUptodate(page) && PageMappedToDisk(page) && !PageDirty(page))
+		cleancache_put_page(page);
+	else
+		cleancache_flush_page(mapping, page);
+
 	radix_tree_delete(&mapping->page_tree, page->index);
 	page->mapping = NULL;
 	mapping->nrpages--;
@@ -2128,6 +2139,9 @@ generic_file_direct_write(struct kiocb *iocb, const struct iovec *iov,
 	 * the new data.  We invalidate clean cached page from the region we're
 	 * about to write.  We do this *before* the write so that we can return
 	 * without clobbering -EIOCBQUEUED from ->direct_IO().
+	 *
+	 * Reclaim may have left no pages but copies in cleancache, which
+	 * the next buffered read would find: drop those whatever nrpages.
 	 */
 	if (mapping->nrpages) {
 		written = invalidate_inode_pages2_range(mapping,
@@ -2141,7 +2155,8 @@ generic_file_direct_write(struct kiocb *iocb, const struct iovec *iov,
 				return 0;
 			goto out;
 		}
-	}
+	} else
+		cleancache_flush_inode(mapping);
 
 	written = mapping->a_ops->direct_IO(WRITE, iocb, iov, pos, *nr_segs);
 
@@ -2156,7 +2171,8 @@ generic_file_direct_write(struct kiocb *iocb, const struct iovec *iov,
 	if (mapping->nrpages) {
 		invalidate_inode_pages2_range(mapping,
 					      pos >> PAGE_CACHE_SHIFT, end);
-	}
+	} else
+		cleancache_flush_inode(mapping);
 
 	if (written > 0) {
 		loff_t end = pos + written;
@@ -0,0 +1,1408 @@
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * Private anonymous vmas are backed by PMD sized blocks of memory at page
+ * fault time when the policy allows it, and khugepaged collapses the areas
+ * which could not be backed that way at fault time into huge pmds later.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/khugepaged.h>
+#include <linux/memcontrol.h>
+#include <linux/mman.h>
+#include <linux/ksm.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+/*
+ * By default transparent hugepage support is enabled for all mappings
+ * and khugepaged scans all mappings. Defrag is only invoked by
+ * khugepaged hugepage allocations and by page faults inside
+ * MADV_HUGEPAGE regions to avoid the risk of slowing down short lived
+ * allocations.
+ */
+unsigned long transparent_hugepage_flags __read_mostly =
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_ALWAYS
+	(1<<TRANSPARENT_HUGEPAGE_FLAG)|
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_MADVISE
+	(1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)|
+#endif
+	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG)|
+	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG);
+
+/* default scan 8*512 pte (or vmas) every 10 second */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+/* during fragmentation poll the hugepage allocator once every minute */
+static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
+/*
+ * default collapse hugepages if there is at least one pte mapped like
+ * it would have happened if the vma was large enough during page
+ * fault.
+ */
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
+
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+
+#define MM_SLOTS_HASH_HEADS 1024
+static struct hlist_head *mm_slots_hash __read_mostly;
+static struct kmem_cache *mm_slot_cache __read_mostly;
+
+/**
+ * struct mm_slot - hash lookup from mm to mm_slot
+ * @hash: hash collision list
+ * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm: the mm that this information is valid for
+ */
+struct mm_slot {
+	struct hlist_node hash;
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+/**
+ * struct khugepaged_scan - cursor for scanning
+ * @mm_head: the head of the mm list to scan
+ * @mm_slot: the current mm_slot we are scanning
+ * @address: the next address inside that to be scanned
+ *
+ * There is only the one khugepaged_scan instance of this cursor structure.
+ */
+struct khugepaged_scan {
+	struct list_head mm_head;
+	struct mm_slot *mm_slot;
+	unsigned long address;
+};
+static struct khugepaged_scan khugepaged_scan = {
+	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+};
+
+/* vmas which can never be backed by huge pmds */
+#define VM_NO_THP (VM_SHARED | VM_MAYSHARE | VM_PFNMAP | VM_IO |	\
+		   VM_DONTEXPAND | VM_RESERVED | VM_HUGETLB |		\
+		   VM_INSERTPAGE | VM_MIXEDMAP | VM_SAO | VM_NONLINEAR)
+
+#define khugepaged_enabled()					       \
+	(transparent_hugepage_flags &				       \
+	 ((1<<TRANSPARENT_HUGEPAGE_FLAG) |			       \
+	  (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)))
+#define khugepaged_defrag()					       \
+	(transparent_hugepage_flags &				       \
+	 (1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG))
+
+static inline int transparent_hugepage_defrag(struct vm_area_struct *vma)
+{
+	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+		     &transparent_hugepage_flags))
+		return 1;
+	return test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
+			&transparent_hugepage_flags) &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+/*
+ * Only writable private anonymous memory is backed by huge pmds:
+ * everything else keeps going through the pte level.
+ */
+static inline int hugepage_vma_check(struct vm_area_struct *vma)
+{
+	if (vma->vm_ops || vma->vm_file)
+		return 0;
+	if (vma->vm_flags & VM_NO_THP)
+		return 0;
+	return vma->vm_flags & VM_WRITE;
+}
+
+static inline int khugepaged_test_exit(struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) == 0;
+}
+
+/*
+ * The page tables the huge pmds of an mm will be split into are allocated
+ * when the huge pmd is established, so that splitting can never fail.
+ * They are queued on mm->pmd_huge_pte through their page->lru.
+ */
+static void pgtable_trans_huge_deposit(struct mm_struct *mm, pgtable_t pgtable)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t pgtable_trans_huge_withdraw(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = mm->pmd_huge_pte;
+	VM_BUG_ON(!pgtable);
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+/*
+ * A huge page is a naturally aligned block of HPAGE_PMD_NR order-0 pages,
+ * not a compound page: each subpage is refcounted on its own.
+ */
+static struct page *alloc_hugepage(int defrag)
+{
+	gfp_t gfp_mask = GFP_HIGHUSER_MOVABLE | __GFP_NORETRY | __GFP_NOWARN;
+	struct page *page;
+
+	if (!defrag)
+		gfp_mask &= ~__GFP_WAIT;
+	page = alloc_pages(gfp_mask, HPAGE_PMD_ORDER);
+	if (page)
+		split_page(page, HPAGE_PMD_ORDER);
+	return page;
+}
+
+static void free_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		put_page(page + i);
+}
+
+static int charge_hugepage(struct page *page, struct mm_struct *mm)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_cgroup_newpage_charge(page + i, mm, GFP_KERNEL)) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void uncharge_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		mem_cgroup_uncharge_page(page + i);
+}
+
+/* Called with page_table_lock held, the new subpages are not mapped yet */
+static void hugepage_add_new_anon_rmap(struct page *page,
+				       struct vm_area_struct *vma,
+				       unsigned long haddr)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE)
+		page_add_new_anon_rmap(page + i, vma, haddr);
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (!hugepage_vma_check(vma))
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	if (unlikely(khugepaged_enter(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage(transparent_hugepage_defrag(vma));
+	if (unlikely(!page))
+		return VM_FAULT_FALLBACK;
+	if (unlikely(charge_hugepage(page, mm)))
+		goto out_free_page;
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		goto out_uncharge;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		__SetPageUptodate(page + i);
+		cond_resched();
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* raced with another fault: let it be retried */
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		uncharge_hugepage(page);
+		free_hugepage(page);
+		return 0;
+	}
+	hugepage_add_new_anon_rmap(page, vma, haddr);
+	entry = mk_pmd(page, vma->vm_page_prot);
+	entry = pmd_mkhuge(pmd_mkwrite(pmd_mkdirty(entry)));
+	pgtable_trans_huge_deposit(mm, pgtable);
+	set_pmd_at(mm, haddr, pmd, entry);
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+
+	inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	return 0;
+
+out_uncharge:
+	uncharge_hugepage(page);
+out_free_page:
+	free_hugepage(page);
+	return VM_FAULT_FALLBACK;
+}
+
+/* Called with page_table_lock held and a pmd_trans_huge() pmd */
+struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+				   unsigned long address,
+				   pmd_t *pmd,
+				   unsigned int flags)
+{
+	struct page *page;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	if ((flags & FOLL_WRITE) && !pmd_write(*pmd))
+		return NULL;
+
+	page = pfn_to_page(pmd_pfn(*pmd));
+	page += (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	if (flags & FOLL_GET)
+		get_page(page);
+	/* huge pmds are always dirty, so only the access is left to track */
+	if (flags & FOLL_TOUCH)
+		mark_page_accessed(page);
+	return page;
+}
+
+/*
+ * Replace the huge pmd by the page table deposited for it, with ptes
+ * mapping the very same pages.
+ */
+void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig_pmd, _pmd;
+	int i;
+
+	VM_BUG_ON(is_vm_hugetlb_page(vma));
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	/*
+	 * Never let the same address be mapped by a huge and a small
+	 * TLB entry at the same time: flush before the ptes go in.
+	 */
+	orig_pmd = pmdp_clear_flush(vma, haddr, pmd);
+	page = pfn_to_page(pmd_pfn(orig_pmd));
+
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+
+		/* huge pmds are always dirty */
+		entry = pte_mkdirty(mk_pte(page + i, vma->vm_page_prot));
+		if (pmd_write(orig_pmd))
+			entry = pte_mkwrite(entry);
+		if (!pmd_young(orig_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	/* the ptes must be visible before the pmd pointing to them */
+	smp_wmb();
+	pmd_populate(mm, pmd, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	return pmd_offset(pud, address);
+}
+
+void split_huge_page_address(struct vm_area_struct *vma,
+			     unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = mm_find_pmd(vma->vm_mm, address);
+	if (pmd)
+		split_huge_page_pmd(vma, address, pmd);
+}
+
+/*
+ * Check that @page is mapped at @address into @mm by a huge pmd.
+ *
+ * On success returns with page_table_lock held.
+ */
+pmd_t *page_check_address_pmd(struct page *page, struct mm_struct *mm,
+			      unsigned long address)
+{
+	unsigned long pfn;
+	pmd_t *pmd;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_trans_huge(*pmd))
+		return NULL;
+
+	pfn = page_to_pfn(page) - ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_pfn(*pmd) == pfn)
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+/*
+ * Called by page_referenced_one() with page_table_lock held, after it
+ * found and cleared the young bit of the huge pmd mapping @page.  The
+ * bit stood for every subpage, so set PG_referenced on all the others;
+ * @page itself gets the reference counted by the caller.
+ */
+void mark_huge_pmd_referenced(struct page *page, pmd_t *pmd)
+{
+	struct page *head = pfn_to_page(pmd_pfn(*pmd));
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (head + i != page)
+			SetPageReferenced(head + i);
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		if (*vm_flags & VM_NO_THP)
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * vm_flags are only updated by our caller: register the
+		 * mm with khugepaged now, khugepaged_enter() would still
+		 * see the old flags.
+		 */
+		if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+		    khugepaged_enabled() && __khugepaged_enter(vma->vm_mm))
+			return -ENOMEM;
+		break;
+	case MADV_NOHUGEPAGE:
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+
+	return 0;
+}
+
+static inline struct mm_slot *alloc_mm_slot(void)
+{
+	if (!mm_slot_cache)	/* initialization failed */
+		return NULL;
+	return kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+}
+
+static inline void free_mm_slot(struct mm_slot *mm_slot)
+{
+	kmem_cache_free(mm_slot_cache, mm_slot);
+}
+
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_head *bucket;
+	struct hlist_node *node;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	hlist_for_each_entry(mm_slot, node, bucket, hash) {
+		if (mm == mm_slot->mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static void insert_to_mm_slots_hash(struct mm_struct *mm,
+				    struct mm_slot *mm_slot)
+{
+	struct hlist_head *bucket;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	mm_slot->mm = mm;
+	hlist_add_head(&mm_slot->hash, bucket);
+}
+
+int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int wakeup;
+
+	mm_slot = alloc_mm_slot();
+	if (!mm_slot)
+		return -ENOMEM;
+
+	/* __khugepaged_exit() must not run from under us */
+	VM_BUG_ON(khugepaged_test_exit(mm));
+	if (unlikely(test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))) {
+		free_mm_slot(mm_slot);
+		return 0;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	insert_to_mm_slots_hash(mm, mm_slot);
+	/*
+	 * Insert just behind the scanning cursor, to let the area settle
+	 * down a little.
+	 */
+	wakeup = list_empty(&khugepaged_scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+
+	atomic_inc(&mm->mm_count);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return 0;
+}
+
+void __khugepaged_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int free = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free = 1;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (free) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	} else if (mm_slot) {
+		/*
+		 * khugepaged is working on this mm: it checks for exit
+		 * under mmap_sem, so wait for it to drop that before the
+		 * page tables go away.  It frees the mm_slot itself.
+		 */
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+static void release_pte_page(struct page *page)
+{
+	/* 0 stands for page_is_file_cache(page) == false */
+	dec_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	unlock_page(page);
+	putback_lru_page(page);
+}
+
+static void release_pte_pages(struct vm_area_struct *vma,
+			      unsigned long address,
+			      pte_t *pte, pte_t *_pte)
+{
+	while (--_pte >= pte) {
+		struct page *page;
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval))
+			continue;
+		page = vm_normal_page(vma, address +
+				      (_pte - pte) * PAGE_SIZE, pteval);
+		if (page)
+			release_pte_page(page);
+	}
+}
+
+/*
+ * Isolate and lock all the pages mapped by the pte table at @address,
+ * which must all be private to this mapping.  Called with the pmd
+ * cleared and flushed, and the pte lock held.
+ */
+static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
+					unsigned long address,
+					pte_t *pte)
+{
+	struct page *page;
+	pte_t *_pte;
+	int referenced = 0, none = 0;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		page = NULL;
+		if (pte_present(pteval))
+			page = vm_normal_page(vma, address, pteval);
+		else if (!pte_none(pteval))
+			goto out;	/* swap entry */
+		if (!page) {
+			/* pte_none, or mapping the zero page */
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		/* cannot use mapcount: can't collapse if there's a gup pin */
+		if (!PageAnon(page) || PageKsm(page) || page_count(page) != 1)
+			goto out;
+		/*
+		 * We can do it before isolate_lru_page because the page
+		 * can't be freed from under us: no other mapping or pin
+		 * can exist, and we hold its pte lock.
+		 */
+		if (!trylock_page(page))
+			goto out;
+		if (isolate_lru_page(page)) {
+			unlock_page(page);
+			goto out;
+		}
+		/* 0 stands for page_is_file_cache(page) == false */
+		inc_zone_page_state(page, NR_ISOLATED_ANON + 0);
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	if (likely(referenced))
+		return 1;
+out:
+	release_pte_pages(vma, address - (_pte - pte) * PAGE_SIZE, pte, _pte);
+	return 0;
+}
+
+/*
+ * Copy the isolated pages into the new block and tear down their ptes.
+ * Called with the pmd cleared, the old pages isolated and locked.
+ */
+static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				      struct vm_area_struct *vma,
+				      unsigned long address,
+				      spinlock_t *ptl)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pte_t *_pte;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, page++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *src_page = NULL;
+
+		if (!pte_none(pteval))
+			src_page = vm_normal_page(vma, address, pteval);
+		if (!src_page) {
+			clear_user_highpage(page, address);
+			spin_lock(ptl);
+			/* the zero page is not accounted in rss */
+			add_mm_counter(mm, anon_rss, 1);
+			pte_clear(mm, address, _pte);
+			spin_unlock(ptl);
+		} else {
+			copy_user_highpage(page, src_page, address, vma);
+			VM_BUG_ON(page_mapcount(src_page) != 1);
+			VM_BUG_ON(page_count(src_page) != 2);
+			dec_zone_page_state(src_page, NR_ISOLATED_ANON + 0);
+			unlock_page(src_page);
+			spin_lock(ptl);
+			pte_clear(mm, address, _pte);
+			page_remove_rmap(src_page);
+			spin_unlock(ptl);
+			/* drop the isolation and the mapping references */
+			put_page(src_page);
+			put_page(src_page);
+		}
+		__SetPageUptodate(page);
+		cond_resched();
+	}
+}
+
+/*
+ * Collapse the pte table at @address into a huge pmd.  Called with
+ * mmap_sem held for reading, returns with it released.
+ */
+static void collapse_huge_page(struct mm_struct *mm,
+			       unsigned long address,
+			       struct page **hpage)
+{
+	struct vm_area_struct *vma;
+	struct page *new_page = *hpage;
+	unsigned long hstart, hend;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	int isolated;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+	VM_BUG_ON(!new_page);
+
+	/*
+	 * Charge before taking mmap_sem for writing: memcg reclaim must
+	 * not run while holding off all the page faults of this mm.
+	 */
+	up_read(&mm->mmap_sem);
+	if (unlikely(charge_hugepage(new_page, mm)))
+		return;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma)
+		goto out;
+	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = vma->vm_end & HPAGE_PMD_MASK;
+	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
+		goto out;
+	if (!transparent_hugepage_enabled(vma) || !hugepage_vma_check(vma) ||
+	    !vma->anon_vma)
+		goto out;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	spin_lock(&vma->anon_vma->lock);
+
+	pte = pte_offset_map(pmd, address);
+	ptl = pte_lockptr(mm, pmd);
+
+	/*
+	 * After this gup_fast and speculative faults can't run anymore,
+	 * and no huge or small TLB entry is left for the range while it
+	 * changes page size.
+	 */
+	spin_lock(&mm->page_table_lock);
+	mmap_seq_write_begin(mm);
+	_pmd = pmdp_clear_flush(vma, address, pmd);
+	mmap_seq_write_end(mm);
+	spin_unlock(&mm->page_table_lock);
+
+	spin_lock(ptl);
+	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	spin_unlock(ptl);
+
+	if (unlikely(!isolated)) {
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		VM_BUG_ON(!pmd_none(*pmd));
+		set_pmd_at(mm, address, pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		spin_unlock(&vma->anon_vma->lock);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+
+	/*
+	 * All the pages are isolated and locked, so the anon_vma rmap
+	 * walkers can't get at them anymore.
+	 */
+	spin_unlock(&vma->anon_vma->lock);
+
+	__collapse_huge_page_copy(pte, new_page, vma, address, ptl);
+	pte_unmap(pte);
+
+	pgtable = pmd_pgtable(_pmd);
+	_pmd = mk_pmd(new_page, vma->vm_page_prot);
+	_pmd = pmd_mkhuge(pmd_mkwrite(pmd_mkdirty(_pmd)));
+
+	/* the copies must be visible before the pmd pointing to them */
+	smp_wmb();
+
+	spin_lock(&mm->page_table_lock);
+	VM_BUG_ON(!pmd_none(*pmd));
+	hugepage_add_new_anon_rmap(new_page, vma, address);
+	set_pmd_at(mm, address, pmd, _pmd);
+	pgtable_trans_huge_deposit(mm, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	inc_zone_page_state(new_page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	*hpage = NULL;
+	khugepaged_pages_collapsed++;
+out_up_write:
+	up_write(&mm->mmap_sem);
+	return;
+
+out:
+	uncharge_hugepage(new_page);
+	goto out_up_write;
+}
+
+/*
+ * Returns 1 if collapse_huge_page() was called, and so mmap_sem dropped.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address,
+			       struct page **hpage)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	int ret = 0, referenced = 0, none = 0;
+	struct page *page;
+	unsigned long _address;
+	spinlock_t *ptl;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_address = address, _pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		page = NULL;
+		if (pte_present(pteval))
+			page = vm_normal_page(vma, _address, pteval);
+		else if (!pte_none(pteval))
+			goto out_unmap;
+		if (!page) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page) ||
+		    PageKsm(page))
+			goto out_unmap;
+		/* cannot use mapcount: can't collapse if there's a gup pin */
+		if (page_count(page) != 1)
+			goto out_unmap;
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	if (referenced)
+		ret = 1;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	if (ret)
+		/* collapse_huge_page will return with the mmap_sem released */
+		collapse_huge_page(mm, address, hpage);
+	return ret;
+}
+
+static void collect_mm_slot(struct mm_slot *mm_slot)
+{
+	struct mm_struct *mm = mm_slot->mm;
+
+	assert_spin_locked(&khugepaged_mm_lock);
+
+	if (khugepaged_test_exit(mm)) {
+		/* free mm_slot */
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	}
+}
+
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+					    struct page **hpage)
+{
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned int progress = 0;
+
+	assert_spin_locked(&khugepaged_mm_lock);
+
+	if (khugepaged_scan.mm_slot)
+		mm_slot = khugepaged_scan.mm_slot;
+	else {
+		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+				     struct mm_slot, mm_node);
+		khugepaged_scan.address = 0;
+		khugepaged_scan.mm_slot = mm_slot;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	mm = mm_slot->mm;
+	down_read(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		vma = NULL;
+	else
+		vma = find_vma(mm, khugepaged_scan.address);
+
+	progress++;
+	for (; vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		cond_resched();
+		if (unlikely(khugepaged_test_exit(mm))) {
+			progress++;
+			break;
+		}
+
+		if (!transparent_hugepage_enabled(vma) ||
+		    !hugepage_vma_check(vma) || !vma->anon_vma) {
+			progress++;
+			continue;
+		}
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (hstart >= hend) {
+			progress++;
+			continue;
+		}
+		if (khugepaged_scan.address < hstart)
+			khugepaged_scan.address = hstart;
+		if (khugepaged_scan.address > hend) {
+			khugepaged_scan.address = hend + HPAGE_PMD_SIZE;
+			progress++;
+			continue;
+		}
+
+		while (khugepaged_scan.address < hend) {
+			int ret;
+
+			cond_resched();
+			if (unlikely(khugepaged_test_exit(mm)))
+				goto breakouterloop;
+
+			ret = khugepaged_scan_pmd(mm, vma,
+						  khugepaged_scan.address,
+						  hpage);
+			/* move to next address */
+			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			if (ret)
+				/* we released mmap_sem so break loop */
+				goto breakouterloop_mmap_sem;
+			if (progress >= pages)
+				goto breakouterloop;
+		}
+	}
+breakouterloop:
+	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
+breakouterloop_mmap_sem:
+
+	spin_lock(&khugepaged_mm_lock);
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	/*
+	 * Release the current mm_slot if this mm is about to die, or
+	 * if we scanned all vmas of this mm.
+	 */
+	if (khugepaged_test_exit(mm) || !vma) {
+		/*
+		 * Make sure that if mm_users is reaching zero while
+		 * khugepaged runs here, khugepaged_exit will find
+		 * mm_slot not pointing to the exiting mm.
+		 */
+		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
+			khugepaged_scan.mm_slot = list_entry(
+				mm_slot->mm_node.next,
+				struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		} else {
+			khugepaged_scan.mm_slot = NULL;
+			khugepaged_full_scans++;
+		}
+
+		collect_mm_slot(mm_slot);
+	}
+
+	return progress;
+}
+
+static int khugepaged_has_work(void)
+{
+	return !list_empty(&khugepaged_scan.mm_head) &&
+		khugepaged_enabled();
+}
+
+/* Returns 1 if the scan stopped because no huge page could be allocated */
+static int khugepaged_do_scan(struct page **hpage)
+{
+	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+
+	barrier(); /* write khugepaged_pages_to_scan to local stack */
+
+	/* pages still on the per-cpu lru_add pagevecs can't be isolated */
+	lru_add_drain_all();
+
+	while (progress < pages) {
+		cond_resched();
+
+		if (!*hpage) {
+			*hpage = alloc_hugepage(khugepaged_defrag());
+			if (unlikely(!*hpage))
+				return 1;
+		}
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot)
+			pass_through_head++;
+		if (khugepaged_has_work() && pass_through_head < 2)
+			progress += khugepaged_scan_mm_slot(pages - progress,
+							    hpage);
+		else
+			progress = pages;
+		spin_unlock(&khugepaged_mm_lock);
+	}
+
+	return 0;
+}
+
+static int khugepaged_wait_event(void)
+{
+	return khugepaged_has_work() || kthread_should_stop();
+}
+
+static int khugepaged(void *none)
+{
+	struct page *hpage = NULL;
+
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		unsigned int msecs;
+
+		if (!khugepaged_has_work()) {
+			wait_event_freezable(khugepaged_wait,
+					     khugepaged_wait_event());
+			continue;
+		}
+
+		if (khugepaged_do_scan(&hpage))
+			msecs = khugepaged_alloc_sleep_millisecs;
+		else
+			msecs = khugepaged_scan_sleep_millisecs;
+		wait_event_freezable_timeout(khugepaged_wait,
+					     kthread_should_stop(),
+					     msecs_to_jiffies(msecs));
+	}
+
+	if (hpage)
+		free_hugepage(hpage);
+	return 0;
+}
+
+#ifdef CONFIG_SYSFS
+
+static ssize_t double_flag_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf,
+				enum transparent_hugepage_flag enabled,
+				enum transparent_hugepage_flag req_madv)
+{
+	if (test_bit(enabled, &transparent_hugepage_flags)) {
+		VM_BUG_ON(test_bit(req_madv, &transparent_hugepage_flags));
+		return sprintf(buf, "[always] madvise never\n");
+	} else if (test_bit(req_madv, &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	else
+		return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t double_flag_store(struct kobject *kobj,
+				 struct kobj_attribute *attr,
+				 const char *buf, size_t count,
+				 enum transparent_hugepage_flag enabled,
+				 enum transparent_hugepage_flag req_madv)
+{
+	if (!memcmp("always", buf,
+		    min(sizeof("always")-1, count))) {
+		set_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else if (!memcmp("madvise", buf,
+			   min(sizeof("madvise")-1, count))) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		set_bit(req_madv, &transparent_hugepage_flags);
+	} else if (!memcmp("never", buf,
+			   min(sizeof("never")-1, count))) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(kobj, attr, buf,
+				TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = double_flag_store(kobj, attr, buf, count,
+				TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+	if (ret > 0)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return ret;
+}
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static ssize_t defrag_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(kobj, attr, buf,
+				TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+
+static ssize_t defrag_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	return double_flag_store(kobj, attr, buf, count,
+				 TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				 TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+static struct kobj_attribute defrag_attr =
+	__ATTR(defrag, 0644, defrag_show, defrag_store);
+
+static struct attribute *hugepage_attr[] = {
+	&enabled_attr.attr,
+	&defrag_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attr,
+};
+
+static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_scan_sleep_millisecs);
+}
+
+static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_scan_sleep_millisecs = msecs;
+	wake_up_interruptible(&khugepaged_wait);
+
+	return count;
+}
+static struct kobj_attribute scan_sleep_millisecs_attr =
+	__ATTR(scan_sleep_millisecs, 0644, scan_sleep_millisecs_show,
+	       scan_sleep_millisecs_store);
+
+static ssize_t alloc_sleep_millisecs_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_alloc_sleep_millisecs);
+}
+
+static ssize_t alloc_sleep_millisecs_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_alloc_sleep_millisecs = msecs;
+	wake_up_interruptible(&khugepaged_wait);
+
+	return count;
+}
+static struct kobj_attribute alloc_sleep_millisecs_attr =
+	__ATTR(alloc_sleep_millisecs, 0644, alloc_sleep_millisecs_show,
+	       alloc_sleep_millisecs_store);
+
+static ssize_t pages_to_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_to_scan);
+}
+
+static ssize_t pages_to_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long pages;
+
+	err = strict_strtoul(buf, 10, &pages);
+	if (err || !pages || pages > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_pages_to_scan = pages;
+
+	return count;
+}
+static struct kobj_attribute pages_to_scan_attr =
+	__ATTR(pages_to_scan, 0644, pages_to_scan_show,
+	       pages_to_scan_store);
+
+static ssize_t pages_collapsed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+}
+static struct kobj_attribute pages_collapsed_attr =
+	__ATTR_RO(pages_collapsed);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_full_scans);
+}
+static struct kobj_attribute full_scans_attr =
+	__ATTR_RO(full_scans);
+
+static ssize_t khugepaged_defrag_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", !!khugepaged_defrag());
+}
+
+static ssize_t khugepaged_defrag_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	unsigned long value;
+	int err;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value > 1)
+		return -EINVAL;
+
+	if (value)
+		set_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+			&transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+			  &transparent_hugepage_flags);
+
+	return count;
+}
+static struct kobj_attribute khugepaged_defrag_attr =
+	__ATTR(defrag, 0644, khugepaged_defrag_show,
+	       khugepaged_defrag_store);
+
+/*
+ * max_ptes_none controls if khugepaged should collapse hugepages over
+ * any unmapped ptes in turn potentially increasing the memory
+ * footprint of the vmas. When max_ptes_none is 0 khugepaged will not
+ * reduce the available free memory in the system as it
+ * runs. Increasing max_ptes_none will instead potentially reduce the
+ * free memory in the system during the khugepaged scan.
+ */
+static ssize_t khugepaged_max_ptes_none_show(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_ptes_none);
+}
+
+static ssize_t khugepaged_max_ptes_none_store(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      const char *buf, size_t count)
+{
+	int err;
+	unsigned long max_ptes_none;
+
+	err = strict_strtoul(buf, 10, &max_ptes_none);
+	if (err || max_ptes_none > HPAGE_PMD_NR-1)
+		return -EINVAL;
+
+	khugepaged_max_ptes_none = max_ptes_none;
+
+	return count;
+}
+static struct kobj_attribute khugepaged_max_ptes_none_attr =
+	__ATTR(max_ptes_none, 0644, khugepaged_max_ptes_none_show,
+	       khugepaged_max_ptes_none_store);
+
+static struct attribute *khugepaged_attr[] = {
+	&khugepaged_defrag_attr.attr,
+	&khugepaged_max_ptes_none_attr.attr,
+	&pages_to_scan_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	&alloc_sleep_millisecs_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attr,
+	.name = "khugepaged",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init khugepaged_slab_init(void)
+{
+	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
+					  sizeof(struct mm_slot),
+					  __alignof__(struct mm_slot), 0, NULL);
+	if (!mm_slot_cache)
+		return -ENOMEM;
+
+	mm_slots_hash = kzalloc(MM_SLOTS_HASH_HEADS * sizeof(struct hlist_head),
+				GFP_KERNEL);
+	if (!mm_slots_hash) {
+		kmem_cache_destroy(mm_slot_cache);
+		mm_slot_cache = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int __init hugepage_init(void)
+{
+	struct task_struct *khugepaged_thread;
+	int err;
+#ifdef CONFIG_SYSFS
+	struct kobject *hugepage_kobj;
+#endif
+
+	err = khugepaged_slab_init();
+	if (err)
+		goto out;
+
+	/*
+	 * With less than 512MB of RAM the memory footprint of huge pages
+	 * outweighs the TLB gains: leave them for MADV_HUGEPAGE only.
+	 */
+	if (totalram_pages < (512 << (20 - PAGE_SHIFT)) &&
+	    test_and_clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			       &transparent_hugepage_flags))
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+
+	khugepaged_thread = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(khugepaged_thread)) {
+		printk(KERN_ERR "hugepage: creating khugepaged failed\n");
+		err = PTR_ERR(khugepaged_thread);
+		goto out;
+	}
+
+#ifdef CONFIG_SYSFS
+	err = -ENOMEM;
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage", mm_kobj);
+	if (unlikely(!hugepage_kobj)) {
+		printk(KERN_ERR "hugepage: failed kobject create\n");
+		goto out_stop;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &hugepage_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register hugepage group\n");
+		goto out_put;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &khugepaged_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register khugepaged group\n");
+		sysfs_remove_group(hugepage_kobj, &hugepage_attr_group);
+		goto out_put;
+	}
+#endif
+
+	return 0;
+
+#ifdef CONFIG_SYSFS
+out_put:
+	kobject_put(hugepage_kobj);
+out_stop:
+	kthread_stop(khugepaged_thread);
+#endif
+out:
+	/* no huge pages without khugepaged to reclaim mm_slots */
+	transparent_hugepage_flags = 0;
+	return err;
+}
+module_init(hugepage_init)
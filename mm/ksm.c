@@ -74,36 +74,61 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * Both trees are sorted first by a key hashed from the start of each page,
+ * and only then by the full contents: the key of a tree node is kept in its
+ * rmap_item, so most steps of a walk compare two integers without touching
+ * the tree page at all.  The volatility checksum of 2) is only taken over a
+ * sample of each page, since it does not have to prove pages identical.
+ *
+ * The scanning is shared between one or more ksmd threads on each node:
+ * every mm is given to a scanner on the node which registered it, and each
+ * scanner walks its own list of mms with its own cursor.  The trees are
+ * shared by all the scanners, so a page can still be merged with a page
+ * found by any other: but they are split by key into KSM_NR_TREES pairs of
+ * stable and unstable tree, each pair with its own mutex.  Identical pages
+ * have identical keys, so always meet in the same pair, while scanners
+ * searching and merging pages of different keys don't wait on each other.
  */
 
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in its scanner's mm_head
  * @rmap_list: head for this mm_slot's list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scan: the scanner which this mm has been given to
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct list_head rmap_list;
 	struct mm_struct *mm;
+	struct ksm_scan *scan;
 };
 
 /**
  * struct ksm_scan - cursor for scanning
+ * @mm_head: head of the list of mm_slots given to this scanner
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_item: the current rmap that we are scanning inside the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @seqnr: ksm_scan_seqnr when the current pass over mm_head was started
+ * @scanned: a pass started at the current ksm_scan_seqnr has completed
+ * @nid: the node this scanner's thread runs on
+ * @thread: the ksmd thread of this scanner
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan instance of this cursor structure per ksmd thread.
  */
 struct ksm_scan {
+	struct mm_slot mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item *rmap_item;
 	unsigned long seqnr;
+	int scanned;
+	int nid;
+	struct task_struct *thread;
 };
 
 /**
@@ -111,6 +136,8 @@ struct ksm_scan {
  * @link: link into mm_slot's rmap_list (rmap_list is per mm)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
+ * @key: prefix key of the page, when in the unstable or stable tree;
+ *	 it also selects which pair of trees that is
  * @oldchecksum: previous checksum of the page at that virtual address
  * @node: rb_node of this rmap_item in either unstable or stable tree
  * @next: next rmap_item hanging off the same node of the stable tree
@@ -120,6 +147,7 @@ struct rmap_item {
 	struct list_head link;
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
+	unsigned int key;
 	union {
 		unsigned int oldchecksum;		/* when unstable */
 		struct rmap_item *next;			/* when stable */
@@ -134,34 +162,63 @@ struct rmap_item {
 #define NODE_FLAG	0x100	/* is a node of unstable or stable tree */
 #define STABLE_FLAG	0x200	/* is a node or list item of stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/* Words at the start of a page hashed into its tree key */
+#define KEY_WORDS	16
+
+/* The volatility checksum samples CHECKSUM_CHUNKS spread over the page */
+#define CHECKSUM_CHUNKS	8
+#define CHECKSUM_WORDS	16
+
+/**
+ * struct ksm_tree - one pair of stable and unstable tree
+ * @mutex: serializes the trees and the rmap_items in them.  It is taken
+ *	   before any mmap_sem, never inside one, except when unmerging,
+ *	   while ksm_thread_sem holds all the ksmds off
+ * @stable: the stable tree head
+ * @unstable: the unstable tree head
+ * @seqnr: count of flushes of the unstable tree, for rmap_item ages
+ */
+struct ksm_tree {
+	struct mutex mutex;
+	struct rb_root stable;
+	struct rb_root unstable;
+	unsigned long seqnr;
+} ____cacheline_aligned_in_smp;
+
+#define KSM_NR_TREES	64
+static struct ksm_tree ksm_trees[KSM_NR_TREES];
+
+/* ksm_scan_mutex serializes ksm_scan_seqnr and the scanners' @scanned */
+static DEFINE_MUTEX(ksm_scan_mutex);
 
 #define MM_SLOTS_HASH_HEADS 1024
 static struct hlist_head *mm_slots_hash;
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+/* The scanners, ksm_threads_per_node for each online node */
+static struct ksm_scan *ksm_scans;
+static unsigned int ksm_nr_scans;
+static unsigned int ksm_threads_per_node = 1;
+
+/*
+ * Count of completed full scans: bumped, and the unstable tree flushed,
+ * once every scanner has completed a pass started at the current count.
+ */
+static unsigned long ksm_scan_seqnr;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *mm_slot_cache;
 
-/* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+/* The number of nodes in the stable trees */
+static atomic_long_t ksm_pages_shared = ATOMIC_LONG_INIT(0);
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing = ATOMIC_LONG_INIT(0);
 
-/* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+/* The number of nodes in the unstable trees */
+static atomic_long_t ksm_pages_unshared = ATOMIC_LONG_INIT(0);
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items = ATOMIC_LONG_INIT(0);
 
 /* Limit on the number of unswappable pages used */
 static unsigned long ksm_max_kernel_pages;
@@ -178,9 +235,19 @@ static unsigned int ksm_thread_sleep_millisecs = 20;
 static unsigned int ksm_run = KSM_RUN_STOP;
 
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
+static int __init setup_ksm_threads(char *str)
+{
+	unsigned long nr;
+
+	if (!strict_strtoul(str, 10, &nr) && nr)
+		ksm_threads_per_node = min(nr, 64UL);
+	return 1;
+}
+__setup("ksm_threads=", setup_ksm_threads);
+
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
 		(__flags), NULL)
@@ -216,13 +283,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -293,6 +360,11 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
  * ksm_test_exit() is used throughout to make this test for exit: in some
  * places for correctness, in some places just to avoid unnecessary work.
  */
+static inline struct ksm_tree *ksm_key_tree(u32 key)
+{
+	return &ksm_trees[key % KSM_NR_TREES];
+}
+
 static inline bool ksm_test_exit(struct mm_struct *mm)
 {
 	return atomic_read(&mm->mm_users) == 0;
@@ -424,9 +496,12 @@ static struct page *get_ksm_page(struct rmap_item *rmap_item)
 /*
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
+ * Called with the mutex of the rmap_item's ksm_key_tree() held.
  */
-static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static void __remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
+	struct ksm_tree *tree = ksm_key_tree(rmap_item->key);
+
 	if (in_stable_tree(rmap_item)) {
 		struct rmap_item *next_item = rmap_item->next;
 
@@ -434,12 +509,12 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			if (next_item) {
 				rb_replace_node(&rmap_item->node,
 						&next_item->node,
-						&root_stable_tree);
+						&tree->stable);
 				next_item->address |= NODE_FLAG;
-				ksm_pages_sharing--;
+				atomic_long_dec(&ksm_pages_sharing);
 			} else {
-				rb_erase(&rmap_item->node, &root_stable_tree);
-				ksm_pages_shared--;
+				rb_erase(&rmap_item->node, &tree->stable);
+				atomic_long_dec(&ksm_pages_shared);
 			}
 		} else {
 			struct rmap_item *prev_item = rmap_item->prev;
@@ -450,7 +525,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 				BUG_ON(next_item->prev != rmap_item);
 				next_item->prev = rmap_item->prev;
 			}
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		}
 
 		rmap_item->next = NULL;
@@ -459,16 +534,16 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		unsigned char age;
 		/*
 		 * Usually ksmd can and must skip the rb_erase, because
-		 * root_unstable_tree was already reset to RB_ROOT.
+		 * the unstable tree was already reset to RB_ROOT.
 		 * But be careful when an mm is exiting: do the rb_erase
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(tree->seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
-		ksm_pages_unshared--;
+			rb_erase(&rmap_item->node, &tree->unstable);
+		atomic_long_dec(&ksm_pages_unshared);
 	}
 
 	rmap_item->address &= PAGE_MASK;
@@ -476,17 +551,49 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 	cond_resched();		/* we're called from many long loops */
 }
 
+/*
+ * An rmap_item's key, and so its pair of trees, only changes while it is
+ * in neither tree, or under the mutex of that pair when it passes from the
+ * unstable to the stable tree: so the owner of an rmap_item can find which
+ * mutex to take from its key.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+{
+	struct ksm_tree *tree = ksm_key_tree(rmap_item->key);
+
+	mutex_lock(&tree->mutex);
+	__remove_rmap_item_from_tree(rmap_item);
+	mutex_unlock(&tree->mutex);
+}
+
+/*
+ * The rmap_items of an mm are unlinked from its rmap_list under mmap_sem,
+ * but cannot be removed from the trees there, without inverting the order
+ * of the tree mutexes and mmap_sem: they are put on a stale list instead, to
+ * be freed by free_stale_rmap_items() once mmap_sem has been dropped.
+ * Until then, the caller must keep a hold on the mm they point to.
+ */
+static void free_stale_rmap_items(struct list_head *stale)
+{
+	struct rmap_item *rmap_item, *next;
+
+	list_for_each_entry_safe(rmap_item, next, stale, link) {
+		remove_rmap_item_from_tree(rmap_item);
+		list_del(&rmap_item->link);
+		free_rmap_item(rmap_item);
+	}
+}
+
 static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
-				       struct list_head *cur)
+				       struct list_head *cur,
+				       struct list_head *stale)
 {
 	struct rmap_item *rmap_item;
 
 	while (cur != &mm_slot->rmap_list) {
 		rmap_item = list_entry(cur, struct rmap_item, link);
 		cur = cur->next;
-		remove_rmap_item_from_tree(rmap_item);
-		list_del(&rmap_item->link);
-		free_rmap_item(rmap_item);
+		list_move_tail(&rmap_item->link, stale);
 	}
 }
 
@@ -522,22 +629,25 @@ static int unmerge_ksm_pages(struct vm_area_struct *vma,
 
 #ifdef CONFIG_SYSFS
 /*
- * Only called through the sysfs control interface:
+ * Only called through the sysfs control interface, with ksm_thread_sem
+ * held for write: so no ksmd can be holding a tree mutex meanwhile, and
+ * the stale rmap_items may be freed without dropping mmap_sem first.
  */
-static int unmerge_and_remove_all_rmap_items(void)
+static int unmerge_scan_rmap_items(struct ksm_scan *scan)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
+	LIST_HEAD(stale);
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	scan->mm_slot = list_entry(scan->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = scan->mm_slot;
+			mm_slot != &scan->mm_head; mm_slot = scan->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -551,10 +661,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 				goto error;
 		}
 
-		remove_trailing_rmap_items(mm_slot, mm_slot->rmap_list.next);
+		remove_trailing_rmap_items(mm_slot, mm_slot->rmap_list.next,
+					   &stale);
+		free_stale_rmap_items(&stale);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		scan->mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hlist_del(&mm_slot->link);
@@ -570,28 +682,85 @@ static int unmerge_and_remove_all_rmap_items(void)
 			up_read(&mm->mmap_sem);
 		}
 	}
-
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	scan->mm_slot = &scan->mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
+
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < ksm_nr_scans; i++) {
+		err = unmerge_scan_rmap_items(&ksm_scans[i]);
+		if (err)
+			return err;
+	}
+
+	/* Every scanner starts afresh, on empty unstable trees */
+	for (i = 0; i < KSM_NR_TREES; i++) {
+		mutex_lock(&ksm_trees[i].mutex);
+		ksm_trees[i].unstable = RB_ROOT;
+		mutex_unlock(&ksm_trees[i].mutex);
+	}
+	mutex_lock(&ksm_scan_mutex);
+	ksm_scan_seqnr = 0;
+	for (i = 0; i < ksm_nr_scans; i++)
+		ksm_scans[i].scanned = 0;
+	mutex_unlock(&ksm_scan_mutex);
+	return 0;
+}
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only has to notice that a page is being modified between
+ * scans, not prove two pages identical: so it hashes one cacheline from
+ * each of CHECKSUM_CHUNKS evenly spaced parts of the page, not all of it.
+ */
 static u32 calc_checksum(struct page *page)
 {
-	u32 checksum;
-	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	u32 checksum = 17;
+	u32 *addr = kmap_atomic(page, KM_USER0);
+	int i;
+
+	for (i = 0; i < CHECKSUM_CHUNKS; i++)
+		checksum = jhash2(addr + i * (PAGE_SIZE / 4 / CHECKSUM_CHUNKS),
+				  CHECKSUM_WORDS, checksum);
 	kunmap_atomic(addr, KM_USER0);
 	return checksum;
 }
 
+/*
+ * The key by which a page is sorted in the trees before its full contents.
+ * Identical pages have identical keys, so pages found to differ by key
+ * need never be compared; and when keys match, memcmp_pages() decides.
+ */
+static u32 calc_key(struct page *page)
+{
+	u32 key;
+	void *addr = kmap_atomic(page, KM_USER0);
+	key = jhash2(addr, KEY_WORDS, 17);
+	kunmap_atomic(addr, KM_USER0);
+	return key;
+}
+
+/*
+ * Compare a page's key with that of a tree node: only when they match
+ * do the tree walks need to get the node's page and compare contents.
+ */
+static inline int cmp_key(u32 key, struct rmap_item *tree_rmap_item)
+{
+	if (key < tree_rmap_item->key)
+		return -1;
+	return key > tree_rmap_item->key;
+}
+
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
 	char *addr1, *addr2;
@@ -813,31 +982,34 @@ out:
  * try_to_merge_two_pages - take two identical pages and prepare them
  * to be merged into one page.
  *
- * This function returns 0 if we successfully mapped two identical pages
- * into one page, -EFAULT otherwise.
+ * This function returns the new ksm page, with a reference held, if we
+ * successfully mapped two identical pages into one page, NULL otherwise.
  *
  * Note that this function allocates a new kernel page: if one of the pages
  * is already a ksm page, try_to_merge_with_ksm_page should be used.
  */
-static int try_to_merge_two_pages(struct mm_struct *mm1, unsigned long addr1,
-				  struct page *page1, struct mm_struct *mm2,
-				  unsigned long addr2, struct page *page2)
+static struct page *try_to_merge_two_pages(struct mm_struct *mm1,
+					   unsigned long addr1,
+					   struct page *page1,
+					   struct mm_struct *mm2,
+					   unsigned long addr2,
+					   struct page *page2)
 {
 	struct vm_area_struct *vma;
 	struct page *kpage;
 	int err = -EFAULT;
 
 	/*
-	 * The number of nodes in the stable tree
+	 * The number of nodes in the stable trees
 	 * is the number of kernel pages that we hold.
 	 */
 	if (ksm_max_kernel_pages &&
-	    ksm_max_kernel_pages <= ksm_pages_shared)
-		return err;
+	    ksm_max_kernel_pages <= atomic_long_read(&ksm_pages_shared))
+		return NULL;
 
 	kpage = alloc_page(GFP_HIGHUSER);
 	if (!kpage)
-		return err;
+		return NULL;
 
 	down_read(&mm1->mmap_sem);
 	if (ksm_test_exit(mm1)) {
@@ -864,34 +1036,50 @@ static int try_to_merge_two_pages(struct mm_struct *mm1, unsigned long addr1,
 			break_cow(mm1, addr1);
 	}
 out:
-	put_page(kpage);
-	return err;
+	if (err) {
+		put_page(kpage);
+		kpage = NULL;
+	}
+	return kpage;
 }
 
 /*
  * stable_tree_search - search page inside the stable tree
+ * @tree: the pair of trees for @key.
  * @page: the page that we are searching identical pages to.
+ * @key: the key of that page, from calc_key().
  * @page2: pointer into identical page that we are holding inside the stable
  *	   tree that we have found.
  * @rmap_item: the reverse mapping item
  *
  * This function checks if there is a page inside the stable tree
  * with identical content to the page that we are scanning right now.
+ * Called with @tree's mutex held.
  *
  * This function return rmap_item pointer to the identical item if found,
  * NULL otherwise.
  */
-static struct rmap_item *stable_tree_search(struct page *page,
+static struct rmap_item *stable_tree_search(struct ksm_tree *tree,
+					    struct page *page, u32 key,
 					    struct page **page2,
 					    struct rmap_item *rmap_item)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node = tree->stable.rb_node;
 
 	while (node) {
 		struct rmap_item *tree_rmap_item, *next_rmap_item;
 		int ret;
 
 		tree_rmap_item = rb_entry(node, struct rmap_item, node);
+		ret = cmp_key(key, tree_rmap_item);
+		if (ret < 0) {
+			node = node->rb_left;
+			continue;
+		} else if (ret > 0) {
+			node = node->rb_right;
+			continue;
+		}
+
 		while (tree_rmap_item) {
 			BUG_ON(!in_stable_tree(tree_rmap_item));
 			cond_resched();
@@ -899,7 +1087,7 @@ static struct rmap_item *stable_tree_search(struct page *page,
 			if (page2[0])
 				break;
 			next_rmap_item = tree_rmap_item->next;
-			remove_rmap_item_from_tree(tree_rmap_item);
+			__remove_rmap_item_from_tree(tree_rmap_item);
 			tree_rmap_item = next_rmap_item;
 		}
 		if (!tree_rmap_item)
@@ -925,16 +1113,20 @@ static struct rmap_item *stable_tree_search(struct page *page,
  * stable_tree_insert - insert rmap_item pointing to new ksm page
  * into the stable tree.
  *
+ * @tree: the pair of trees for @key.
  * @page: the page that we are searching identical page to inside the stable
  *	  tree.
+ * @key: the key of that page, from calc_key().
  * @rmap_item: pointer to the reverse mapping item.
  *
+ * Called with @tree's mutex held.
  * This function returns rmap_item if success, NULL otherwise.
  */
-static struct rmap_item *stable_tree_insert(struct page *page,
+static struct rmap_item *stable_tree_insert(struct ksm_tree *tree,
+					    struct page *page, u32 key,
 					    struct rmap_item *rmap_item)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_node **new = &tree->stable.rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -943,6 +1135,13 @@ static struct rmap_item *stable_tree_insert(struct page *page,
 		int ret;
 
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		ret = cmp_key(key, tree_rmap_item);
+		if (ret) {
+			parent = *new;
+			new = ret < 0 ? &parent->rb_left : &parent->rb_right;
+			continue;
+		}
+
 		while (tree_rmap_item) {
 			BUG_ON(!in_stable_tree(tree_rmap_item));
 			cond_resched();
@@ -950,7 +1149,7 @@ static struct rmap_item *stable_tree_insert(struct page *page,
 			if (tree_page)
 				break;
 			next_rmap_item = tree_rmap_item->next;
-			remove_rmap_item_from_tree(tree_rmap_item);
+			__remove_rmap_item_from_tree(tree_rmap_item);
 			tree_rmap_item = next_rmap_item;
 		}
 		if (!tree_rmap_item)
@@ -975,25 +1174,32 @@ static struct rmap_item *stable_tree_insert(struct page *page,
 	}
 
 	rmap_item->address |= NODE_FLAG | STABLE_FLAG;
+	rmap_item->key = key;
 	rmap_item->next = NULL;
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_stable_tree);
+	rb_insert_color(&rmap_item->node, &tree->stable);
 
-	ksm_pages_shared++;
+	atomic_long_inc(&ksm_pages_shared);
 	return rmap_item;
 }
 
 /*
  * unstable_tree_search_insert - search and insert items into the unstable tree.
  *
+ * @tree: the pair of trees for @key
  * @page: the page that we are going to search for identical page or to insert
  *	  into the unstable tree
+ * @key: the key of that page, from calc_key()
  * @page2: pointer into identical page that was found inside the unstable tree
  * @rmap_item: the reverse mapping item of page
  *
  * This function searches for a page in the unstable tree identical to the
  * page currently being scanned; and if no identical page is found in the
  * tree, we insert rmap_item as a new object into the unstable tree.
+ * Called with @tree's mutex held.
+ *
+ * The key of an unstable tree node may be out of date with its page, like
+ * the order of the tree itself: that only means we may miss a match there.
  *
  * This function returns pointer to rmap_item found to be identical
  * to the currently scanned page, NULL otherwise.
@@ -1001,11 +1207,12 @@ static struct rmap_item *stable_tree_insert(struct page *page,
  * This function does both searching and inserting, because they share
  * the same walking algorithm in an rbtree.
  */
-static struct rmap_item *unstable_tree_search_insert(struct page *page,
+static struct rmap_item *unstable_tree_search_insert(struct ksm_tree *tree,
+						struct page *page, u32 key,
 						struct page **page2,
 						struct rmap_item *rmap_item)
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node **new = &tree->unstable.rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1014,6 +1221,13 @@ static struct rmap_item *unstable_tree_search_insert(struct page *page,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		ret = cmp_key(key, tree_rmap_item);
+		if (ret) {
+			parent = *new;
+			new = ret < 0 ? &parent->rb_left : &parent->rb_right;
+			continue;
+		}
+
 		page2[0] = get_mergeable_page(tree_rmap_item);
 		if (!page2[0])
 			return NULL;
@@ -1042,22 +1256,25 @@ static struct rmap_item *unstable_tree_search_insert(struct page *page,
 	}
 
 	rmap_item->address |= NODE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (tree->seqnr & SEQNR_MASK);
+	rmap_item->key = key;
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &tree->unstable);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
 /*
  * stable_tree_append - add another rmap_item to the linked list of
  * rmap_items hanging off a given node of the stable tree, all sharing
- * the same ksm page.
+ * the same ksm page.  It takes the node's key, in case it has to take
+ * the node's place in the tree later.
  */
 static void stable_tree_append(struct rmap_item *rmap_item,
 			       struct rmap_item *tree_rmap_item)
 {
+	rmap_item->key = tree_rmap_item->key;
 	rmap_item->next = tree_rmap_item->next;
 	rmap_item->prev = tree_rmap_item;
 
@@ -1067,7 +1284,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	tree_rmap_item->next = rmap_item;
 	rmap_item->address |= STABLE_FLAG;
 
-	ksm_pages_sharing++;
+	atomic_long_inc(&ksm_pages_sharing);
 }
 
 /*
@@ -1082,15 +1299,34 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 {
 	struct page *page2[1];
+	struct page *kpage;
 	struct rmap_item *tree_rmap_item;
+	struct ksm_tree *tree, *old_tree;
 	unsigned int checksum;
+	u32 key;
 	int err;
 
-	if (in_stable_tree(rmap_item))
-		remove_rmap_item_from_tree(rmap_item);
+	key = calc_key(page);
+	tree = ksm_key_tree(key);
+
+	old_tree = ksm_key_tree(rmap_item->key);
+	mutex_lock(&old_tree->mutex);
+	/*
+	 * Another ksmd may have merged this page with one of its own since
+	 * we looked: then it's already where it should be in the stable tree.
+	 */
+	if (PageKsm(page) && in_stable_tree(rmap_item)) {
+		mutex_unlock(&old_tree->mutex);
+		return;
+	}
+	__remove_rmap_item_from_tree(rmap_item);
+	if (old_tree != tree) {
+		mutex_unlock(&old_tree->mutex);
+		mutex_lock(&tree->mutex);
+	}
 
 	/* We first start with searching the page inside the stable tree */
-	tree_rmap_item = stable_tree_search(page, page2, rmap_item);
+	tree_rmap_item = stable_tree_search(tree, page, key, page2, rmap_item);
 	if (tree_rmap_item) {
 		if (page == page2[0])			/* forked */
 			err = 0;
@@ -1107,8 +1343,9 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			 */
 			stable_tree_append(rmap_item, tree_rmap_item);
 		}
-		return;
+		goto out_unlock;
 	}
+	mutex_unlock(&tree->mutex);
 
 	/*
 	 * A ksm page might have got here by fork, but its other
@@ -1124,6 +1361,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * have calculated it, this page to be changed frequely, therefore we
 	 * don't want to insert it to the unstable tree, and we don't want to
 	 * waste our time to search if there is something identical to it there.
+	 * The rmap_item is in neither tree now, so nobody else can touch it.
 	 */
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
@@ -1131,60 +1369,66 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
-	tree_rmap_item = unstable_tree_search_insert(page, page2, rmap_item);
+	mutex_lock(&tree->mutex);
+	tree_rmap_item = unstable_tree_search_insert(tree, page, key, page2,
+						     rmap_item);
 	if (tree_rmap_item) {
-		err = try_to_merge_two_pages(rmap_item->mm,
-					     rmap_item->address, page,
-					     tree_rmap_item->mm,
-					     tree_rmap_item->address, page2[0]);
+		kpage = try_to_merge_two_pages(rmap_item->mm,
+					       rmap_item->address, page,
+					       tree_rmap_item->mm,
+					       tree_rmap_item->address,
+					       page2[0]);
+		put_page(page2[0]);
 		/*
 		 * As soon as we merge this page, we want to remove the
 		 * rmap_item of the page we have merged with from the unstable
 		 * tree, and insert it instead as new node in the stable tree.
 		 */
-		if (!err) {
-			rb_erase(&tree_rmap_item->node, &root_unstable_tree);
+		if (kpage) {
+			rb_erase(&tree_rmap_item->node, &tree->unstable);
 			tree_rmap_item->address &= ~NODE_FLAG;
-			ksm_pages_unshared--;
+			atomic_long_dec(&ksm_pages_unshared);
 
 			/*
-			 * If we fail to insert the page into the stable tree,
-			 * we will have 2 virtual addresses that are pointing
-			 * to a ksm page left outside the stable tree,
-			 * in which case we need to break_cow on both.
+			 * Our key was taken before the page was write-protected,
+			 * so take the key of the ksm page afresh.  If it belongs
+			 * to another pair of trees, or we fail to insert the
+			 * page into the stable tree, we will have 2 virtual
+			 * addresses that are pointing to a ksm page left outside
+			 * the stable tree, in which case we need to break_cow
+			 * on both.
 			 */
-			if (stable_tree_insert(page2[0], tree_rmap_item))
+			key = calc_key(kpage);
+			if (ksm_key_tree(key) == tree &&
+			    stable_tree_insert(tree, kpage, key, tree_rmap_item))
 				stable_tree_append(rmap_item, tree_rmap_item);
 			else {
 				break_cow(tree_rmap_item->mm,
 						tree_rmap_item->address);
 				break_cow(rmap_item->mm, rmap_item->address);
 			}
+			put_page(kpage);
 		}
-
-		put_page(page2[0]);
 	}
+out_unlock:
+	mutex_unlock(&tree->mutex);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 					    struct list_head *cur,
-					    unsigned long addr)
+					    unsigned long addr,
+					    struct list_head *stale)
 {
 	struct rmap_item *rmap_item;
 
 	while (cur != &mm_slot->rmap_list) {
 		rmap_item = list_entry(cur, struct rmap_item, link);
-		if ((rmap_item->address & PAGE_MASK) == addr) {
-			if (!in_stable_tree(rmap_item))
-				remove_rmap_item_from_tree(rmap_item);
+		if ((rmap_item->address & PAGE_MASK) == addr)
 			return rmap_item;
-		}
 		if (rmap_item->address > addr)
 			break;
 		cur = cur->next;
-		remove_rmap_item_from_tree(rmap_item);
-		list_del(&rmap_item->link);
-		free_rmap_item(rmap_item);
+		list_move_tail(&rmap_item->link, stale);
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1197,27 +1441,70 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * ksm_scan_done - note that scan has completed a pass over its mms.
+ *
+ * The unstable tree may only be flushed when every rmap_item in it will
+ * have been revisited before the next flush, so that its seqnr age never
+ * exceeds 1: that is, once each scanner with work to do has completed a
+ * pass which it started since the last flush.
+ */
+static void ksm_scan_done(struct ksm_scan *scan)
+{
+	unsigned int i;
+
+	mutex_lock(&ksm_scan_mutex);
+	if (scan->seqnr == ksm_scan_seqnr)
+		scan->scanned = 1;
+
+	for (i = 0; i < ksm_nr_scans; i++) {
+		struct ksm_scan *other = &ksm_scans[i];
+
+		if (!other->scanned &&
+		    !list_empty(&other->mm_head.mm_list))
+			goto out;
+	}
+
+	/*
+	 * Each unstable tree counts its own flushes, so that an rmap_item's
+	 * age is right whichever side of its tree's flush it was inserted.
+	 */
+	for (i = 0; i < KSM_NR_TREES; i++) {
+		mutex_lock(&ksm_trees[i].mutex);
+		ksm_trees[i].unstable = RB_ROOT;
+		ksm_trees[i].seqnr++;
+		mutex_unlock(&ksm_trees[i].mutex);
+	}
+	ksm_scan_seqnr++;
+	for (i = 0; i < ksm_nr_scans; i++)
+		ksm_scans[i].scanned = 0;
+out:
+	mutex_unlock(&ksm_scan_mutex);
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	LIST_HEAD(stale);
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (list_empty(&scan->mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		root_unstable_tree = RB_ROOT;
+	slot = scan->mm_slot;
+	if (slot == &scan->mm_head) {
+		scan->seqnr = ACCESS_ONCE(ksm_scan_seqnr);
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_item = list_entry(&slot->rmap_list,
+		scan->address = 0;
+		scan->rmap_item = list_entry(&slot->rmap_list,
 						struct rmap_item, link);
 	}
 
@@ -1226,56 +1513,58 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (*page && PageAnon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_item->link.next,
-					ksm_scan.address);
+					scan->rmap_item->link.next,
+					scan->address, &stale);
 				if (rmap_item) {
-					ksm_scan.rmap_item = rmap_item;
-					ksm_scan.address += PAGE_SIZE;
+					scan->rmap_item = rmap_item;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				/* Still at the cursor, the mm cannot go away */
+				free_stale_rmap_items(&stale);
 				return rmap_item;
 			}
 			if (*page)
 				put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_item = list_entry(&slot->rmap_list,
+		scan->address = 0;
+		scan->rmap_item = list_entry(&slot->rmap_list,
 						struct rmap_item, link);
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_item->link.next);
+	remove_trailing_rmap_items(slot, scan->rmap_item->link.next, &stale);
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+	scan->mm_slot = list_entry(slot->mm_list.next,
 						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1292,33 +1581,42 @@ next_mm:
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(&stale);
 		mmdrop(mm);
 	} else {
+		/*
+		 * Off the cursor, __ksm_exit might free the mm_slot and drop
+		 * its hold on mm before the stale rmap_items are freed.
+		 */
+		atomic_inc(&mm->mm_count);
 		spin_unlock(&ksm_mmlist_lock);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(&stale);
+		mmdrop(mm);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &scan->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	ksm_scan_done(scan);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @scan - the scanner to advance.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_scan *scan, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *page;
 
 	while (scan_npages--) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(scan, &page);
 		if (!rmap_item)
 			return;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
@@ -1335,27 +1633,33 @@ static void ksm_do_scan(unsigned int scan_npages)
 	}
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *scan)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) &&
+		!list_empty(&scan->mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_scan *scan = data;
+	const struct cpumask *cpumask = cpumask_of_node(scan->nid);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run(scan))
+			ksm_do_scan(scan, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(scan)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
 			wait_event_interruptible(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(scan) || kthread_should_stop());
 		}
 	}
 	return 0;
@@ -1404,8 +1708,28 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 	return 0;
 }
 
+/*
+ * Give mm to one of the scanners on the node it is registered from,
+ * spreading the mms of that node between them.
+ */
+static struct ksm_scan *ksm_scan_for_mm(struct mm_struct *mm)
+{
+	int nid = numa_node_id();
+	unsigned int i;
+
+	for (i = 0; i < ksm_nr_scans; i++) {
+		if (ksm_scans[i].nid == nid) {
+			i += ((unsigned long)mm / sizeof(struct mm_struct)) %
+				ksm_threads_per_node;
+			return &ksm_scans[i];
+		}
+	}
+	return &ksm_scans[0];	/* node came online after ksm_init */
+}
+
 int __ksm_enter(struct mm_struct *mm)
 {
+	struct ksm_scan *scan;
 	struct mm_slot *mm_slot;
 	int needs_wakeup;
 
@@ -1413,8 +1737,11 @@ int __ksm_enter(struct mm_struct *mm)
 	if (!mm_slot)
 		return -ENOMEM;
 
+	scan = ksm_scan_for_mm(mm);
+	mm_slot->scan = scan;
+
 	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	needs_wakeup = list_empty(&scan->mm_head.mm_list);
 
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
@@ -1423,7 +1750,7 @@ int __ksm_enter(struct mm_struct *mm)
 	 * down a little; when fork is followed by immediate exec, we don't
 	 * want ksmd to waste time setting up and tearing down an rmap_list.
 	 */
-	list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	list_add_tail(&mm_slot->mm_list, &scan->mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1451,14 +1778,14 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->scan->mm_slot != mm_slot) {
 		if (list_empty(&mm_slot->rmap_list)) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
 			easy_to_free = 1;
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &mm_slot->scan->mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1555,7 +1882,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * mm_slots on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	if (ksm_run != flags) {
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
@@ -1568,7 +1895,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -1603,21 +1930,21 @@ KSM_ATTR(max_kernel_pages);
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -1626,8 +1953,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -1641,10 +1970,17 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_scan_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t nr_threads_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_scans);
+}
+KSM_ATTR_RO(nr_threads);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1655,6 +1991,7 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&nr_threads_attr.attr,
 	NULL,
 };
 
@@ -1664,13 +2001,49 @@ static struct attribute_group ksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+static int __init ksm_scans_init(void)
+{
+	struct ksm_scan *scan;
+	unsigned int i;
+	int nid;
+
+	ksm_scans = kzalloc(num_online_nodes() * ksm_threads_per_node *
+			    sizeof(struct ksm_scan), GFP_KERNEL);
+	if (!ksm_scans)
+		return -ENOMEM;
+
+	for_each_online_node(nid) {
+		for (i = 0; i < ksm_threads_per_node; i++) {
+			scan = &ksm_scans[ksm_nr_scans++];
+			INIT_LIST_HEAD(&scan->mm_head.mm_list);
+			scan->mm_head.scan = scan;
+			scan->mm_slot = &scan->mm_head;
+			scan->nid = nid;
+		}
+	}
+	return 0;
+}
+
+static void __init ksm_scans_stop(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ksm_nr_scans; i++)
+		if (ksm_scans[i].thread)
+			kthread_stop(ksm_scans[i].thread);
+}
+
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
+	unsigned int i;
 	int err;
 
 	ksm_max_kernel_pages = totalram_pages / 4;
 
+	for (i = 0; i < KSM_NR_TREES; i++)
+		mutex_init(&ksm_trees[i].mutex);
+
 	err = ksm_slab_init();
 	if (err)
 		goto out;
@@ -1679,19 +2052,30 @@ static int __init ksm_init(void)
 	if (err)
 		goto out_free1;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = ksm_scans_init();
+	if (err)
 		goto out_free2;
+
+	for (i = 0; i < ksm_nr_scans; i++) {
+		if (ksm_nr_scans == 1)
+			ksm_thread = kthread_run(ksm_scan_thread,
+						 &ksm_scans[i], "ksmd");
+		else
+			ksm_thread = kthread_run(ksm_scan_thread,
+						 &ksm_scans[i], "ksmd/%u", i);
+		if (IS_ERR(ksm_thread)) {
+			printk(KERN_ERR "ksm: creating kthread failed\n");
+			err = PTR_ERR(ksm_thread);
+			goto out_free3;
+		}
+		ksm_scans[i].thread = ksm_thread;
 	}
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
-		goto out_free2;
+		goto out_free3;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -1700,6 +2084,9 @@ static int __init ksm_init(void)
 
 	return 0;
 
+out_free3:
+	ksm_scans_stop();
+	kfree(ksm_scans);
 out_free2:
 	mm_slots_hash_free();
 out_free1:
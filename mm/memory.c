@@ -56,6 +56,7 @@
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
+#include <linux/file.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -702,7 +703,8 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(src_pmd))
+		split_huge_page_pmd(vma, addr, src_pmd);
+		if (pmd_none_or_trans_huge_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
@@ -898,7 +900,8 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		split_huge_page_pmd(vma, addr, pmd);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
@@ -1163,11 +1166,21 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
-	if (pmd_huge(*pmd)) {
+	if (pmd_huge(*pmd) && vma->vm_flags & VM_HUGETLB) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
 		goto out;
 	}
+	if (pmd_trans_huge(*pmd)) {
+		spin_lock(&mm->page_table_lock);
+		if (likely(pmd_trans_huge(*pmd))) {
+			page = follow_trans_huge_pmd(mm, address, pmd, flags);
+			spin_unlock(&mm->page_table_lock);
+			goto out;
+		}
+		/* split from under us: go through the ptes */
+		spin_unlock(&mm->page_table_lock);
+	}
 	if (unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
 
@@ -2519,11 +2532,11 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
 		grab_swap_token(mm); /* Contend for token _before_ read-in */
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		page = swapin_vma_readahead(entry,
+					GFP_HIGHUSER_MOVABLE, vma, address, pmd);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -3008,13 +3021,331 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+		int ret = do_huge_pmd_anonymous_page(mm, vma, address,
+						     pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else {
+		pmd_t orig_pmd = *pmd;
+
+		barrier();
+		if (pmd_trans_huge(orig_pmd)) {
+			/* spurious, or racing with the fault that mapped it */
+			if (!(flags & FAULT_FLAG_WRITE) || pmd_write(orig_pmd))
+				return 0;
+			split_huge_page_pmd(vma, address, pmd);
+		}
+	}
+
+	/*
+	 * Use __pte_alloc instead of pte_alloc_map, because we can't
+	 * run pte_offset_map on the pmd if a huge pmd could materialize
+	 * from under us from a different thread.
+	 */
+	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	/* if a huge pmd materialized from under us just retry later */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/* Deepest rbtree walk tried without mmap_sem, before giving up on it */
+#define SPF_MAX_DEPTH	64
+
+/*
+ * find_vma() for handle_speculative_fault(): the rbtree may be in the
+ * middle of a rebalance, so the walk is bounded, and what it finds is
+ * only good if mmap_seq has not changed meanwhile.  Returns the vma
+ * containing addr, if found.
+ */
+static struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+						   unsigned long addr)
+{
+	struct rb_node *rb_node = rcu_dereference(mm->mm_rb.rb_node);
+	int depth = SPF_MAX_DEPTH;
+
+	while (rb_node && depth--) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (vma->vm_end > addr) {
+			if (vma->vm_start <= addr)
+				return vma;
+			rb_node = rcu_dereference(rb_node->rb_left);
+		} else
+			rb_node = rcu_dereference(rb_node->rb_right);
+	}
+	return NULL;
+}
+
+/*
+ * Map and lock the pte for address, if mmap_seq is still at seq.
+ *
+ * Interrupts are disabled while walking down to it: a page table is only
+ * freed after a TLB flush, which cannot complete on this cpu meanwhile,
+ * just as for get_user_pages_fast().  Once mmap_seq is found unchanged
+ * under the pte lock, any later munmap, mprotect or collapse has to take
+ * the pte lock to get at the pte.  The lock is only tried, since its
+ * holder may be waiting for that TLB flush.
+ *
+ * Returns NULL if there is no pte table there, or on any contention.
+ */
+static pte_t *spf_pte_map_lock(struct mm_struct *mm, unsigned long address,
+			       unsigned seq, spinlock_t **ptlp)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte;
+	spinlock_t *ptl;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto out;
+
+	pte = pte_offset_map(&pmdval, address);
+	ptl = pte_lockptr(mm, &pmdval);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out;
+	}
+	if (mmap_seq_read_retry(mm, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+	local_irq_enable();
+	*ptlp = ptl;
+	return pte;
+out:
+	local_irq_enable();
+	return NULL;
+}
+
+/*
+ * do_anonymous_page() without mmap_sem.  copy is a copy of vma as it was
+ * at seq, for use until the pte lock is held with mmap_sem unchanged:
+ * vma itself may be freed until then.  Any failure is left to the fault
+ * under mmap_sem.
+ */
+static int do_speculative_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, struct vm_area_struct *copy,
+		unsigned long address, unsigned int flags, unsigned seq)
+{
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *page_table;
+	pte_t entry;
+
+	if (!(flags & FAULT_FLAG_WRITE)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						copy->vm_page_prot));
+	} else {
+		page = alloc_zeroed_user_highpage_movable(copy, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+
+		entry = mk_pte(page, copy->vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	page_table = spf_pte_map_lock(mm, address, seq, &ptl);
+	if (!page_table)
+		goto release;
+	if (!pte_none(*page_table)) {
+		pte_unmap_unlock(page_table, ptl);
+		goto release;
+	}
+
+	if (page) {
+		inc_mm_counter(mm, anon_rss);
+		page_add_new_anon_rmap(page, vma, address);
+	}
+	set_pte_at(mm, address, page_table, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+	pte_unmap_unlock(page_table, ptl);
+	return 0;
+release:
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+	return VM_FAULT_RETRY;
+}
+
+/*
+ * A read fault on page cache by filemap_fault(), without mmap_sem.
+ * vma and copy are as for do_speculative_anonymous_page(), and a
+ * reference is held on copy->vm_file.
+ */
+static int do_speculative_read_fault(struct mm_struct *mm,
+		struct vm_area_struct *vma, struct vm_area_struct *copy,
+		unsigned long address, unsigned int flags, unsigned seq)
+{
+	struct vm_fault vmf;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *page_table;
+	pte_t entry;
+	int ret;
+
+	vmf.virtual_address = (void __user *)(address & PAGE_MASK);
+	vmf.pgoff = (((address & PAGE_MASK) - copy->vm_start) >> PAGE_SHIFT) +
+			copy->vm_pgoff;
+	vmf.flags = flags;
+	vmf.page = NULL;
+
+	ret = filemap_fault(copy, &vmf);
+	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE)))
+		return VM_FAULT_RETRY;
+
+	page = vmf.page;
+	if (unlikely(!(ret & VM_FAULT_LOCKED)))
+		lock_page(page);
+	if (unlikely(PageHWPoison(page)))
+		goto release;
+
+	page_table = spf_pte_map_lock(mm, address, seq, &ptl);
+	if (!page_table)
+		goto release;
+	if (!pte_none(*page_table)) {
+		pte_unmap_unlock(page_table, ptl);
+		goto release;
+	}
+
+	flush_icache_page(vma, page);
+	entry = mk_pte(page, vma->vm_page_prot);
+	inc_mm_counter(mm, file_rss);
+	page_add_file_rmap(page);
+	set_pte_at(mm, address, page_table, entry);
+
+	/* no need to invalidate: a not-present page won't be cached */
+	update_mmu_cache(vma, address, entry);
+	pte_unmap_unlock(page_table, ptl);
+	unlock_page(page);
+	return ret & VM_FAULT_MAJOR;
+release:
+	unlock_page(page);
+	page_cache_release(page);
+	return VM_FAULT_RETRY;
+}
+
+/*
+ * Handle a fault on a page which is not mapped yet, without taking
+ * mmap_sem, so without waiting for mmap or munmap in other threads.
+ *
+ * The vma is looked up under RCU, vmas being freed by RCU, and copied;
+ * mm->mmap_seq, which is bumped by every change to the vmas or to which
+ * page tables they map, then tells if the copy was consistent, and again
+ * under the pte lock if it is still current as the pte is set.  Only the
+ * common cases are handled, an anonymous page or a page cache read:
+ * anything else, any error or any race returns VM_FAULT_RETRY, and the
+ * fault is then to be handled by handle_mm_fault() under mmap_sem.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, copy;
+	struct file *file = NULL;
+	spinlock_t *ptl;
+	pte_t *pte;
+	unsigned seq;
+	int ret = VM_FAULT_RETRY;
+
+	seq = mmap_seq_read_begin(mm);
+	if (seq & 1)
+		return VM_FAULT_RETRY;
+
+	rcu_read_lock();
+	vma = find_vma_speculative(mm, address);
+	if (!vma) {
+		rcu_read_unlock();
+		return VM_FAULT_RETRY;
+	}
+	copy = *vma;
+	/* A file is freed by RCU too: pin it if it is still open */
+	if (copy.vm_file) {
+		if (!atomic_long_inc_not_zero(&copy.vm_file->f_count)) {
+			rcu_read_unlock();
+			return VM_FAULT_RETRY;
+		}
+		file = copy.vm_file;
+	}
+	rcu_read_unlock();
+	if (mmap_seq_read_retry(mm, seq))
+		goto out;
+
+	if (copy.vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP |
+			     VM_NONLINEAR))
+		goto out;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(copy.vm_flags & VM_WRITE))
+			goto out;
+	} else if (!(copy.vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out;
+
+	/* Only a pte still none, in a pte table already there, is done here */
+	pte = spf_pte_map_lock(mm, address, seq, &ptl);
+	if (!pte)
+		goto out;
+	if (!pte_none(*pte)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+	pte_unmap_unlock(pte, ptl);
+
+	if (!copy.vm_ops) {
+		if (copy.vm_file)
+			goto out;
+		/* Leave anon_vma_prepare() to handle_mm_fault() */
+		if ((flags & FAULT_FLAG_WRITE) && !copy.anon_vma)
+			goto out;
+#ifdef CONFIG_NUMA
+		/* A policy is only safe to use under mmap_sem */
+		if (copy.vm_policy)
+			goto out;
+#endif
+		ret = do_speculative_anonymous_page(mm, vma, &copy, address,
+						    flags, seq);
+	} else if (copy.vm_ops->fault == filemap_fault &&
+		   !(flags & FAULT_FLAG_WRITE)) {
+		ret = do_speculative_read_fault(mm, vma, &copy, address,
+						flags, seq);
+	}
+out:
+	if (file)
+		fput(file);
+	if (!(ret & VM_FAULT_RETRY)) {
+		__set_current_state(TASK_RUNNING);
+		count_vm_event(PGFAULT);
+		count_vm_event(PGFAULT_SPECULATIVE);
+	}
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -102,7 +102,7 @@ static void remove_migration_pte(struct vm_area_struct *vma,
                 return;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		return;
 
 	ptep = pte_offset_map(pmd, addr);
@@ -180,7 +180,8 @@ static void remove_anon_migration_ptes(struct page *old, struct page *new)
 		return;
 
 	/*
-	 * We hold the mmap_sem lock. So no need to call page_lock_anon_vma.
+	 * The caller holds either the mmap_sem or a reference on the
+	 * anon_vma, so no need to call page_lock_anon_vma.
 	 */
 	anon_vma = (struct anon_vma *) (mapping - PAGE_MAPPING_ANON);
 	spin_lock(&anon_vma->lock);
@@ -545,7 +546,8 @@ static int fallback_migrate_page(struct address_space *mapping,
  *   < 0 - error code
  *  == 0 - success
  */
-static int move_to_new_page(struct page *newpage, struct page *page)
+static int move_to_new_page(struct page *newpage, struct page *page,
+						int remap_swapcache)
 {
 	struct address_space *mapping;
 	int rc;
@@ -581,7 +583,8 @@ static int move_to_new_page(struct page *newpage, struct page *page)
 		rc = fallback_migrate_page(mapping, newpage, page);
 
 	if (!rc) {
-		remove_migration_ptes(page, newpage);
+		if (remap_swapcache)
+			remove_migration_ptes(page, newpage);
 	} else
 		newpage->mapping = NULL;
 
@@ -603,6 +606,8 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	int rcu_locked = 0;
 	int charge = 0;
 	struct mem_cgroup *mem = NULL;
+	int remap_swapcache = 1;
+	struct anon_vma *anon_vma = NULL;
 
 	if (!newpage)
 		return -ENOMEM;
@@ -641,10 +646,27 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	 * of migration. File cache pages are no problem because of page_lock()
 	 * File Caches may use write_page() or lock_page() in migration, then,
 	 * just care Anon page here.
+	 *
+	 * Callers such as memory compaction do not hold the mmap_sem, so the
+	 * last vma of the anon_vma may be unmapped under us: keep the
+	 * anon_vma alive with a reference until the ptes are restored.  An
+	 * unmapped page has no ptes to restore and its anon_vma may already
+	 * be gone, so it is only migrated if it is in the swap cache.
 	 */
 	if (PageAnon(page)) {
 		rcu_read_lock();
 		rcu_locked = 1;
+
+		if (!page_mapped(page)) {
+			if (!PageSwapCache(page))
+				goto rcu_unlock;
+			remap_swapcache = 0;
+		} else {
+			anon_vma = page_anon_vma(page);
+			if (!anon_vma)
+				goto rcu_unlock;
+			get_anon_vma(anon_vma);
+		}
 	}
 
 	/*
@@ -679,11 +701,14 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 
 skip_unmap:
 	if (!page_mapped(page))
-		rc = move_to_new_page(newpage, page);
+		rc = move_to_new_page(newpage, page, remap_swapcache);
 
-	if (rc)
+	if (rc && remap_swapcache)
 		remove_migration_ptes(page, page);
 rcu_unlock:
+	if (anon_vma)
+		drop_anon_vma(anon_vma);
+
 	if (rcu_locked)
 		rcu_read_unlock();
 uncharge:
@@ -223,6 +223,27 @@ void unlink_file_vma(struct vm_area_struct *vma)
 	}
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void __free_vma(struct rcu_head *head)
+{
+	kmem_cache_free(vm_area_cachep,
+			container_of(head, struct vm_area_struct, vm_rcu_head));
+}
+#endif
+
+/*
+ * Free a vma which has been linked into the mm: handle_speculative_fault()
+ * may still be looking at it, until an RCU grace period has passed.
+ */
+static void free_vma(struct vm_area_struct *vma)
+{
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	call_rcu(&vma->vm_rcu_head, __free_vma);
+#else
+	kmem_cache_free(vm_area_cachep, vma);
+#endif
+}
+
 /*
  * Close a vm structure and free it, returning the next.
  */
@@ -239,7 +260,7 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 			removed_exe_file_vma(vma->vm_mm);
 	}
 	mpol_put(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	free_vma(vma);
 	return next;
 }
 
@@ -456,7 +477,9 @@ static void vma_link(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 	anon_vma_lock(vma);
 
+	mmap_seq_write_begin(mm);
 	__vma_link(mm, vma, prev, rb_link, rb_parent);
+	mmap_seq_write_end(mm);
 	__vma_link_file(vma);
 
 	anon_vma_unlock(vma);
@@ -594,6 +617,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			vma_prio_tree_remove(next, root);
 	}
 
+	mmap_seq_write_begin(mm);
 	vma->vm_start = start;
 	vma->vm_end = end;
 	vma->vm_pgoff = pgoff;
@@ -627,6 +651,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 		 */
 		__insert_vm_struct(mm, insert);
 	}
+	mmap_seq_write_end(mm);
 
 	if (anon_vma)
 		spin_unlock(&anon_vma->lock);
@@ -641,7 +666,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 		}
 		mm->map_count--;
 		mpol_put(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		free_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -1630,8 +1655,13 @@ int expand_upwards(struct vm_area_struct *vma, unsigned long address)
 		grow = (address - vma->vm_end) >> PAGE_SHIFT;
 
 		error = acct_stack_growth(vma, size, grow);
-		if (!error)
+		if (!error) {
+			spin_lock(&vma->vm_mm->page_table_lock);
+			mmap_seq_write_begin(vma->vm_mm);
 			vma->vm_end = address;
+			mmap_seq_write_end(vma->vm_mm);
+			spin_unlock(&vma->vm_mm->page_table_lock);
+		}
 	}
 	anon_vma_unlock(vma);
 	return error;
@@ -1675,8 +1705,12 @@ static int expand_downwards(struct vm_area_struct *vma,
 
 		error = acct_stack_growth(vma, size, grow);
 		if (!error) {
+			spin_lock(&vma->vm_mm->page_table_lock);
+			mmap_seq_write_begin(vma->vm_mm);
 			vma->vm_start = address;
 			vma->vm_pgoff -= grow;
+			mmap_seq_write_end(vma->vm_mm);
+			spin_unlock(&vma->vm_mm->page_table_lock);
 		}
 	}
 	anon_vma_unlock(vma);
@@ -1798,6 +1832,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	unsigned long addr;
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
+	mmap_seq_write_begin(mm);
 	do {
 		rb_erase(&vma->vm_rb, &mm->mm_rb);
 		mm->map_count--;
@@ -1806,6 +1841,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	} while (vma && vma->vm_start < end);
 	*insertion_point = vma;
 	tail_vma->vm_next = NULL;
+	mmap_seq_write_end(mm);
 	if (mm->unmap_area == arch_unmap_area)
 		addr = prev ? prev->vm_end : mm->mmap_base;
 	else
@@ -48,6 +48,7 @@
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
 #include <linux/kmemleak.h>
+#include <linux/compaction.h>
 #include <trace/events/kmem.h>
 
 #include <asm/tlbflush.h>
@@ -80,6 +81,7 @@ int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_hot_cold_page(struct page *page, unsigned int order, int cold);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -516,10 +518,94 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * The pcp list of pages of an order and migrate type
+ */
+static inline int order_to_pindex(int migratetype, unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
+/*
+ * The number of pages to move between the pcp lists and the buddy lists
+ * at once: pcp->batch, doubled batch_scale times while zone->lock is found
+ * contended, but not beyond half of pcp->high.
+ */
+#define PCP_BATCH_SCALE_MAX	3
+
+static inline int pcp_batch(struct per_cpu_pages *pcp)
+{
+	return min(pcp->batch << pcp->batch_scale,
+		   max(pcp->high / 2, pcp->batch));
+}
+
+/*
+ * Take zone->lock to move a batch of pages for this pcp.  Waiting for it
+ * scales up the batch, so that the next trips to the buddy lists are
+ * fewer; getting it at once scales the batch back down.
+ */
+static inline void pcp_lock_zone(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	if (spin_trylock(&zone->lock)) {
+		if (pcp->batch_scale)
+			pcp->batch_scale--;
+		return;
+	}
+	spin_lock(&zone->lock);
+	if (pcp->batch_scale < PCP_BATCH_SCALE_MAX)
+		pcp->batch_scale++;
+}
+
+#ifdef CONFIG_NUMA
+static void splice_remote_pages(struct zone *zone, struct list_head *list)
+{
+	if (!zone->remote_count)
+		return;
+	spin_lock(&zone->remote_lock);
+	list_splice_init(&zone->remote_free, list);
+	zone->remote_count = 0;
+	spin_unlock(&zone->remote_lock);
+}
+#else
+static inline void splice_remote_pages(struct zone *zone,
+					struct list_head *list)
+{
+}
+#endif
+
+/*
+ * Free the pages spliced off zone->remote_free, which have their order
+ * in page_private.  Their migrate type is read now, under zone->lock, so
+ * an isolated pageblock gets them back.  Returns the number of pages.
+ */
+static int __free_remote_pages(struct zone *zone, struct list_head *list)
+{
+	int freed = 0;
+
+	while (!list_empty(list)) {
+		struct page *page = list_entry(list->next, struct page, lru);
+		unsigned int order = page_private(page);
+
+		list_del(&page->lru);
+		__free_one_page(page, zone, order,
+				get_pageblock_migratetype(page));
+		freed += 1 << order;
+	}
+	return freed;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of pages to free: it may be exceeded by the last
+ * page freed being of high order.  pcp->count is updated here.
+ * The pages queued on the zone by other nodes are freed under the same
+ * hold of zone->lock.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -530,17 +616,22 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
+	int freed = 0;
+	LIST_HEAD(remote);
 
-	spin_lock(&zone->lock);
+	count = min(count, pcp->count);
+	splice_remote_pages(zone, &remote);
+
+	pcp_lock_zone(zone, pcp);
 	zone_clear_flag(zone, ZONE_ALL_UNRECLAIMABLE);
 	zone->pages_scanned = 0;
 
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
-	while (count) {
+	while (count > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -551,20 +642,28 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
+		order = pindex_to_order(pindex);
 
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--count && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order,
+						 page_private(page));
+			freed += 1 << order;
+			count -= 1 << order;
+		} while (count > 0 && --batch_free && !list_empty(list));
 	}
+	pcp->count -= freed;
+
+	freed += __free_remote_pages(zone, &remote);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed);
 	spin_unlock(&zone->lock);
 }
 
@@ -585,8 +684,14 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	unsigned long flags;
 	int i;
 	int bad = 0;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
 
+	if (order <= PAGE_ALLOC_COSTLY_ORDER) {
+		free_hot_cold_page(page, order, 0);
+		return;
+	}
+
+	wasMlocked = __TestClearPageMlocked(page);
 	kmemcheck_free_shadow(page, order);
 
 	for (i = 0 ; i < (1 << order) ; ++i)
@@ -936,16 +1041,16 @@ retry_reserve:
 
 /* 
  * Obtain a specified number of elements from the buddy allocator, all under
- * a single hold of the lock, for efficiency.  Add them to the supplied list.
- * Returns the number of new pages which were placed at *list.
+ * a single hold of the lock, for efficiency.  Add them to the supplied list
+ * of the pcp.  Returns the number of new elements which were placed at *list.
  */
 static int rmqueue_bulk(struct zone *zone, unsigned int order, 
 			unsigned long count, struct list_head *list,
-			int migratetype, int cold)
+			int migratetype, int cold, struct per_cpu_pages *pcp)
 {
 	int i;
 	
-	spin_lock(&zone->lock);
+	pcp_lock_zone(zone, pcp);
 	for (i = 0; i < count; ++i) {
 		struct page *page = __rmqueue(zone, order, migratetype);
 		if (unlikely(page == NULL))
@@ -984,15 +1089,9 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 {
 	unsigned long flags;
-	int to_drain;
 
 	local_irq_save(flags);
-	if (pcp->count >= pcp->batch)
-		to_drain = pcp->batch;
-	else
-		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
+	free_pcppages_bulk(zone, pcp_batch(pcp), pcp);
 	local_irq_restore(flags);
 }
 #endif
@@ -1018,7 +1117,6 @@ static void drain_pages(unsigned int cpu)
 		pcp = &pset->pcp;
 		local_irq_save(flags);
 		free_pcppages_bulk(zone, pcp->count, pcp);
-		pcp->count = 0;
 		local_irq_restore(flags);
 	}
 }
@@ -1075,30 +1173,66 @@ void mark_free_pages(struct zone *zone)
 }
 #endif /* CONFIG_PM */
 
+#ifdef CONFIG_NUMA
+/*
+ * A page of a zone on another node is not kept on this cpu's pcp lists,
+ * where it would be stranded until refresh_cpu_vm_stats() drains them,
+ * but queued on the zone's remote free list, under remote_lock rather
+ * than zone->lock.  The list is freed in bulk by the next
+ * free_pcppages_bulk() on the zone, from whichever cpu, or here once it
+ * has outgrown pcp->high.
+ */
+static void free_remote_page(struct zone *zone, struct page *page,
+			unsigned int order, struct per_cpu_pages *pcp)
+{
+	int count;
+
+	set_page_private(page, order);
+	spin_lock(&zone->remote_lock);
+	list_add(&page->lru, &zone->remote_free);
+	zone->remote_count += 1 << order;
+	count = zone->remote_count;
+	spin_unlock(&zone->remote_lock);
+
+	if (count >= pcp->high)
+		free_pcppages_bulk(zone, 0, pcp);
+}
+#endif
+
 /*
- * Free a 0-order page
+ * Free a page of order up to PAGE_ALLOC_COSTLY_ORDER
  */
-static void free_hot_cold_page(struct page *page, int cold)
+static void free_hot_cold_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
+	int i;
+	int bad = 0;
 
-	kmemcheck_free_shadow(page, 0);
+	kmemcheck_free_shadow(page, order);
 
 	if (PageAnon(page))
 		page->mapping = NULL;
-	if (free_pages_check(page))
+	for (i = 0 ; i < (1 << order) ; ++i)
+		bad += free_pages_check(page + i);
+	if (bad)
 		return;
+	/* Pages on the pcp lists are never compound */
+	if (unlikely(PageCompound(page)))
+		if (unlikely(destroy_compound_page(page, order)))
+			return;
 
 	if (!PageHighMem(page)) {
-		debug_check_no_locks_freed(page_address(page), PAGE_SIZE);
-		debug_check_no_obj_freed(page_address(page), PAGE_SIZE);
+		debug_check_no_locks_freed(page_address(page),
+					   PAGE_SIZE << order);
+		debug_check_no_obj_freed(page_address(page),
+					 PAGE_SIZE << order);
 	}
-	arch_free_page(page, 0);
-	kernel_map_pages(page, 1, 0);
+	arch_free_page(page, order);
+	kernel_map_pages(page, 1 << order, 0);
 
 	pcp = &zone_pcp(zone, get_cpu())->pcp;
 	migratetype = get_pageblock_migratetype(page);
@@ -1106,7 +1240,7 @@ static void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1117,21 +1251,28 @@ static void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
+#ifdef CONFIG_NUMA
+	if (unlikely(zone_to_nid(zone) != numa_node_id())) {
+		free_remote_page(zone, page, order, pcp);
+		goto out;
+	}
+#endif
+
 	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		list_add_tail(&page->lru,
+			&pcp->lists[order_to_pindex(migratetype, order)]);
 	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
+		list_add(&page->lru,
+			&pcp->lists[order_to_pindex(migratetype, order)]);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
+		free_pcppages_bulk(zone, pcp_batch(pcp), pcp);
 
 out:
 	local_irq_restore(flags);
@@ -1141,7 +1282,7 @@ out:
 void free_hot_page(struct page *page)
 {
 	trace_mm_page_free_direct(page, 0);
-	free_hot_cold_page(page, 0);
+	free_hot_cold_page(page, 0, 0);
 }
 	
 /*
@@ -1172,6 +1313,51 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free. As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * As this is called with interrupts disabled, the caller is responsible
+ * for calling arch_alloc_page() and kernel_map_page() after interrupts
+ * are enabled.
+ *
+ * Note: this is probably too low level an operation for use in drivers.
+ * Please consult with lkml before using this in your driver.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = low_wmark_pages(zone) + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1187,19 +1373,33 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	int cold = !!(gfp_flags & __GFP_COLD);
 	int cpu;
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
 	cpu  = get_cpu();
-	if (likely(order == 0)) {
+	if (likely(order <= PAGE_ALLOC_COSTLY_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		pcp = &zone_pcp(zone, cpu)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		local_irq_save(flags);
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			pcp->count += rmqueue_bulk(zone, order,
+					max(pcp_batch(pcp) >> order, 1), list,
+					migratetype, cold, pcp) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1210,21 +1410,8 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -1672,6 +1859,64 @@ out:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype, unsigned long *did_some_progress)
+{
+	struct page *page;
+	struct task_struct *p = current;
+
+	if (!order || compaction_deferred(preferred_zone))
+		return NULL;
+
+	p->flags |= PF_MEMALLOC;
+	*did_some_progress = try_to_compact_pages(zonelist, order, gfp_mask,
+						nodemask);
+	p->flags &= ~PF_MEMALLOC;
+	if (*did_some_progress != COMPACT_SKIPPED) {
+
+		/* Page migration frees to the PCP lists but we want merging */
+		drain_pages(get_cpu());
+		put_cpu();
+
+		page = get_page_from_freelist(gfp_mask, nodemask,
+				order, zonelist, high_zoneidx,
+				alloc_flags, preferred_zone,
+				migratetype);
+		if (page) {
+			compaction_reset_defer(preferred_zone);
+			count_vm_event(COMPACTSUCCESS);
+			return page;
+		}
+
+		/*
+		 * It's bad if compaction run occurs and fails.
+		 * The most likely reason is that pages exist,
+		 * but not enough to satisfy watermarks.
+		 */
+		count_vm_event(COMPACTFAIL);
+		defer_compaction(preferred_zone);
+
+		cond_resched();
+	}
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype, unsigned long *did_some_progress)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /* The really slow allocator path where we enter direct reclaim */
 static inline struct page *
 __alloc_pages_direct_reclaim(gfp_t gfp_mask, unsigned int order,
@@ -1858,6 +2103,15 @@ rebalance:
 	if (test_thread_flag(TIF_MEMDIE) && !(gfp_mask & __GFP_NOFAIL))
 		goto nopage;
 
+	/* Try direct compaction */
+	page = __alloc_pages_direct_compact(gfp_mask, order,
+					zonelist, high_zoneidx,
+					nodemask,
+					alloc_flags, preferred_zone,
+					migratetype, &did_some_progress);
+	if (page)
+		goto got_pg;
+
 	/* Try direct reclaim and then allocating */
 	page = __alloc_pages_direct_reclaim(gfp_mask, order,
 					zonelist, high_zoneidx,
@@ -2000,7 +2254,7 @@ void __pagevec_free(struct pagevec *pvec)
 
 	while (--i >= 0) {
 		trace_mm_pagevec_free(pvec->pages[i], pvec->cold);
-		free_hot_cold_page(pvec->pages[i], pvec->cold);
+		free_hot_cold_page(pvec->pages[i], 0, pvec->cold);
 	}
 }
 
@@ -3072,7 +3326,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3080,8 +3334,9 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	pcp->batch_scale = 0;
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -3850,6 +4105,10 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 		zone->name = zone_names[j];
 		spin_lock_init(&zone->lock);
+#ifdef CONFIG_NUMA
+		spin_lock_init(&zone->remote_lock);
+		INIT_LIST_HEAD(&zone->remote_free);
+#endif
 		spin_lock_init(&zone->lru_lock);
 		zone_seqlock_init(zone);
 		zone->zone_pgdat = pgdat;
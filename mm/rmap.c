@@ -171,18 +171,36 @@ void anon_vma_unlink(struct vm_area_struct *vma)
 	list_del(&vma->anon_vma_node);
 
 	/* We must garbage collect the anon_vma if it's empty */
-	empty = list_empty(&anon_vma->head);
+	empty = list_empty(&anon_vma->head) && !migrate_refcount(anon_vma);
 	spin_unlock(&anon_vma->lock);
 
 	if (empty)
 		anon_vma_free(anon_vma);
 }
 
+#ifdef CONFIG_MIGRATION
+/*
+ * Drop a reference taken with get_anon_vma(), freeing the anon_vma if
+ * its vmas went away in the meantime.
+ */
+void drop_anon_vma(struct anon_vma *anon_vma)
+{
+	if (atomic_dec_and_lock(&anon_vma->migrate_refcount, &anon_vma->lock)) {
+		int empty = list_empty(&anon_vma->head);
+
+		spin_unlock(&anon_vma->lock);
+		if (empty)
+			anon_vma_free(anon_vma);
+	}
+}
+#endif
+
 static void anon_vma_ctor(void *data)
 {
 	struct anon_vma *anon_vma = data;
 
 	spin_lock_init(&anon_vma->lock);
+	migrate_refcount_init(anon_vma);
 	INIT_LIST_HEAD(&anon_vma->head);
 }
 
@@ -289,6 +307,9 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	/* huge pmds are looked up with page_check_address_pmd() */
+	if (pmd_trans_huge(*pmd))
+		return NULL;
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -344,7 +365,8 @@ static int page_referenced_one(struct page *page,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	unsigned long address;
-	pte_t *pte;
+	pmd_t *pmd = NULL;
+	pte_t *pte = NULL;
 	spinlock_t *ptl;
 	int referenced = 0;
 
@@ -352,9 +374,15 @@ static int page_referenced_one(struct page *page,
 	if (address == -EFAULT)
 		goto out;
 
-	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
-		goto out;
+	if (PageAnon(page))
+		pmd = page_check_address_pmd(page, mm, address);
+	if (pmd) {
+		ptl = &mm->page_table_lock;
+	} else {
+		pte = page_check_address(page, mm, address, &ptl, 0);
+		if (!pte)
+			goto out;
+	}
 
 	/*
 	 * Don't want to elevate referenced for mlocked page that gets this far,
@@ -367,7 +395,17 @@ static int page_referenced_one(struct page *page,
 		goto out_unmap;
 	}
 
-	if (ptep_clear_flush_young_notify(vma, address, pte)) {
+	if (pte ? ptep_clear_flush_young_notify(vma, address, pte) :
+		  pmdp_clear_flush_young_notify(vma, address & HPAGE_PMD_MASK,
+						pmd)) {
+		/*
+		 * All the subpages of a huge pmd share its young bit but
+		 * are aged one by one on the LRU: hand the reference we
+		 * just cleared on to the others, or all but the first
+		 * one scanned would look idle.
+		 */
+		if (pmd)
+			mark_huge_pmd_referenced(page, pmd);
 		/*
 		 * Don't treat a reference through a sequentially read
 		 * mapping as such.  If the page has been used in
@@ -387,7 +425,10 @@ static int page_referenced_one(struct page *page,
 
 out_unmap:
 	(*mapcount)--;
-	pte_unmap_unlock(pte, ptl);
+	if (pte)
+		pte_unmap_unlock(pte, ptl);
+	else
+		spin_unlock(ptl);
 out:
 	if (referenced)
 		*vm_flags |= vma->vm_flags;
@@ -774,6 +815,10 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	if (address == -EFAULT)
 		goto out;
 
+	/* unmapping goes through the ptes the huge pmd is split into */
+	if (PageAnon(page))
+		split_huge_page_address(vma, address);
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -49,6 +49,32 @@ struct address_space swapper_space = {
 
 #define INC_CACHE_INFO(x)	do { swap_cache_info.x++; } while (0)
 
+/*
+ * Swap readahead hits, for sizing the readahead window: counted per vma
+ * in vma->swap_readahead_info when reading ahead by virtual address, and
+ * in swapin_readahead_hits when reading ahead by swap offset.  The vma's
+ * word packs the address of its last swap fault, the window read then,
+ * and the hits on pages read ahead since.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Most ptes copied for one virtual address readahead */
+#define SWAP_RA_PTES_MAX	32
+
+static atomic_long_t swapin_readahead_hits = ATOMIC_LONG_INIT(4);
+
 static struct {
 	unsigned long add_total;
 	unsigned long del_total;
@@ -255,28 +281,53 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
+ *
+ * If the page was brought in by readahead, count a hit for the vma
+ * faulting on it at addr, or for swap offset readahead if vma is NULL.
+ * (PG_readahead shares its bit with PG_reclaim, which vmscan may set
+ * on a swap cache page under writeback: leave that alone.)
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page *lookup_swap_cache(swp_entry_t entry,
+			       struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		if (!PageWriteback(page) && TestClearPageReadahead(page)) {
+			count_vm_event(SWAP_RA_HIT);
+			if (vma) {
+				unsigned long ra_val, hits;
+
+				ra_val = atomic_long_read(
+						&vma->swap_readahead_info);
+				hits = min(SWAP_RA_HITS(ra_val) + 1,
+					   SWAP_RA_HITS_MAX);
+				atomic_long_set(&vma->swap_readahead_info,
+					SWAP_RA_VAL(addr, SWAP_RA_WIN(ra_val),
+						    hits));
+			} else
+				atomic_long_inc(&swapin_readahead_hits);
+		}
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
 }
 
-/* 
+/*
  * Locate a page of swap in physical memory, reserving swap cache space
  * and reading the disk if it is not already cached.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
+ * If readahead, a page newly read is marked PG_readahead, so that a later
+ * lookup_swap_cache() can tell that the readahead was of use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			int readahead)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -313,6 +364,13 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * But a slot waiting in a swap slots cache will never
+			 * get a page: only readahead stumbles on one, so give
+			 * up on it rather than wait.
+			 */
+			if (swap_slot_cached(entry))
+				break;
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
@@ -329,6 +387,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			/*
 			 * Initiate read into locked page and return.
 			 */
+			if (readahead) {
+				SetPageReadahead(new_page);
+				count_vm_event(SWAP_RA);
+			}
 			lru_cache_add_anon(new_page);
 			swap_readpage(new_page);
 			return new_page;
@@ -348,6 +410,77 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, 0);
+}
+
+/*
+ * How many pages to read around the one faulting at offset (a swap offset,
+ * or a virtual pfn), given the offset and the window of the previous fault,
+ * and the hits on the pages read ahead since.  A window is a power of 2.
+ */
+static unsigned int __swapin_nr_pages(unsigned long prev_offset,
+				      unsigned long offset,
+				      int hits, int max_pages,
+				      int prev_win)
+{
+	unsigned int pages, last_ra;
+
+	/*
+	 * This heuristic has been found to work well on both sequential and
+	 * random loads, swapping to hard disk or to SSD: please don't ask
+	 * what the "+ 2" means, it just happens to work well, that's all.
+	 */
+	pages = hits + 2;
+	if (pages == 2) {
+		/*
+		 * We can have no readahead hits to judge by: but must not get
+		 * stuck here forever, so check for an adjacent offset instead
+		 * (and don't even bother if the window could only be 1 page).
+		 */
+		if (offset != prev_offset + 1 && offset != prev_offset - 1)
+			pages = 1;
+	} else {
+		unsigned int roundup = 4;
+		while (roundup < pages)
+			roundup <<= 1;
+		pages = roundup;
+	}
+
+	if (pages > max_pages)
+		pages = max_pages;
+
+	/* Don't shrink readahead too fast */
+	last_ra = prev_win / 2;
+	if (pages < last_ra)
+		pages = last_ra;
+
+	return pages;
+}
+
+/* The window for readahead by swap offset, sized by swapin_readahead_hits */
+static unsigned long swapin_nr_pages(unsigned long offset)
+{
+	static unsigned long prev_offset;
+	static atomic_t last_readahead_pages;
+	unsigned int hits, pages, max_pages;
+
+	max_pages = 1 << ACCESS_ONCE(page_cluster);
+	if (max_pages <= 1)
+		return 1;
+
+	hits = atomic_long_xchg(&swapin_readahead_hits, 0);
+	pages = __swapin_nr_pages(prev_offset, offset, hits, max_pages,
+				  atomic_read(&last_readahead_pages));
+	if (!hits)
+		prev_offset = offset;
+	atomic_set(&last_readahead_pages, pages);
+
+	return pages;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -358,9 +491,11 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
  * Returns the struct page for entry and addr, after queueing swapin.
  *
  * Primitive swap readahead code. We simply read an aligned block of
- * (1 << page_cluster) entries in the swap area. This method is chosen
- * because it doesn't cost us any seek time.  We also make sure to queue
- * the 'original' request together with the readahead ones...
+ * entries in the swap area. This method is chosen because it doesn't
+ * cost us any seek time.  We also make sure to queue the 'original'
+ * request together with the readahead ones...  The block is at most
+ * (1 << page_cluster) entries, and shrinks to the faulting entry alone
+ * while the pages read ahead are not being used.
  *
  * This has been extended to use the NUMA policies from the mm triggering
  * the readahead.
@@ -372,7 +507,7 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 {
 	int nr_pages;
 	struct page *page;
-	unsigned long offset;
+	unsigned long offset = swp_offset(entry);
 	unsigned long end_offset;
 
 	/*
@@ -382,11 +517,14 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	 * more likely that neighbouring swap pages came from the same node:
 	 * so use the same "addr" to choose the same node for each swap read.
 	 */
-	nr_pages = valid_swaphandles(entry, &offset);
+	nr_pages = valid_swaphandles(entry, ilog2(swapin_nr_pages(offset)),
+				     &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
+		page = __read_swap_cache_async(
+					swp_entry(swp_type(entry), offset),
+					gfp_mask, vma, addr,
+					offset != swp_offset(entry));
 		if (!page)
 			break;
 		page_cache_release(page);
@@ -394,3 +532,103 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/**
+ * swapin_vma_readahead - swap in pages virtually adjacent to a fault
+ * @entry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: target address
+ * @pmd: the pmd mapping the page table of addr
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ *
+ * Like swapin_readahead(), but reads the swap entries of the ptes around
+ * addr in the vma, rather than the entries around entry in the swap area:
+ * pages swapped out together are not necessarily used together, pages
+ * mapped together more probably are.  The window is sized by the hits
+ * on the pages that this vma read ahead before: it grows in the direction
+ * of sequential faults, and shrinks to the faulting page alone while
+ * readahead is of no use.  It is confined to the page table of addr.
+ *
+ * Caller must hold down_read on the vma->vm_mm, but not the pte lock.
+ */
+struct page *swapin_vma_readahead(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	unsigned long ra_val, pfn, prev_pfn, start, end, faddr;
+	unsigned long lpfn, rpfn;
+	unsigned int max_pages, win, left, i, nr;
+	pte_t ptes[SWAP_RA_PTES_MAX];
+	pte_t *pte;
+	struct page *page;
+
+	max_pages = min(1 << ACCESS_ONCE(page_cluster), SWAP_RA_PTES_MAX);
+	faddr = addr & PAGE_MASK;
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	pfn = PFN_DOWN(faddr);
+	prev_pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
+	if (max_pages <= 1)
+		win = 1;
+	else
+		win = __swapin_nr_pages(prev_pfn, pfn, SWAP_RA_HITS(ra_val),
+					max_pages, SWAP_RA_WIN(ra_val));
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+	if (win == 1)
+		goto skip;
+
+	/*
+	 * Read ahead in the direction we are going: else around addr.
+	 * Don't let the window wrap below address 0.
+	 */
+	if (pfn == prev_pfn + 1) {
+		lpfn = pfn;
+		rpfn = pfn + win;
+	} else if (pfn == prev_pfn - 1) {
+		lpfn = pfn - min_t(unsigned long, win - 1, pfn);
+		rpfn = pfn + 1;
+	} else {
+		left = min_t(unsigned long, (win - 1) / 2, pfn);
+		lpfn = pfn - left;
+		rpfn = lpfn + win;
+	}
+	start = max(lpfn << PAGE_SHIFT, max(vma->vm_start, faddr & PMD_MASK));
+	end = min(rpfn << PAGE_SHIFT,
+		  min(vma->vm_end, (faddr & PMD_MASK) + PMD_SIZE));
+	if (start >= end)
+		goto skip;
+	nr = (end - start) >> PAGE_SHIFT;
+	if (nr <= 1)
+		goto skip;
+
+	/*
+	 * Copy the ptes without the pte lock: any we read stale are
+	 * rechecked by swapcache_prepare() as their pages are read in.
+	 */
+	pte = pte_offset_map(pmd, start);
+	for (i = 0; i < nr; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	for (i = 0; i < nr; i++, start += PAGE_SIZE) {
+		swp_entry_t swp;
+
+		if (start == faddr)
+			continue;
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+		    pte_file(ptes[i]))
+			continue;
+		swp = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(swp)))
+			continue;
+		page = __read_swap_cache_async(swp, gfp_mask, vma, start, 1);
+		if (!page)
+			continue;
+		page_cache_release(page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(entry, gfp_mask, vma, addr);
+}
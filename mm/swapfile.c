@@ -29,6 +29,8 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/cpu.h>
+#include <linux/sort.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -454,17 +456,25 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to n_goal swap slots, for swap cache, under a single hold of
+ * swap_lock.  The slots are taken from one device while it has space, so a
+ * batch comes out of the current cluster of that device, in sequence.
+ */
+static int get_swap_pages(int n_goal, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int n_ret = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n_goal > nr_swap_pages)
+		n_goal = nr_swap_pages;
+	nr_swap_pages -= n_goal;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info + type;
@@ -482,20 +492,247 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (n_ret < n_goal) {
+			offset = scan_swap_map(si, SWAP_CACHE);
+			if (!offset)
+				break;
+			swp_entries[n_ret++] = swp_entry(type, offset);
 		}
+		if (n_ret == n_goal)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n_goal - n_ret;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return n_ret;
+}
+
+/*
+ * Return a slot which nobody references any more to the free space of its
+ * device.  Called with swap_lock held, on a swap_map entry which is either
+ * 0 or SWAP_HAS_CACHE, left so by swap_entry_free() or get_swap_pages().
+ */
+static void swap_entry_release(struct swap_info_struct *p,
+			       unsigned long offset)
+{
+	p->swap_map[offset] = 0;
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (p->prio > swap_info[swap_list.next].prio)
+		swap_list.next = p - swap_info;
+	nr_swap_pages++;
+	p->inuse_pages--;
+}
+
+static int swp_entry_cmp(const void *ent1, const void *ent2)
+{
+	const swp_entry_t *e1 = ent1, *e2 = ent2;
+
+	if (e1->val < e2->val)
+		return -1;
+	return e1->val > e2->val;
+}
+
+/*
+ * Release a batch of slots under a single hold of swap_lock, in order of
+ * device and offset so that the swap_map is walked forwards.
+ */
+static void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	int i;
+
+	if (n > 1)
+		sort(entries, n, sizeof(entries[0]), swp_entry_cmp, NULL);
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_entry_release(&swap_info[swp_type(entries[i])],
+				   swp_offset(entries[i]));
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Per-cpu swap slots caches.
+ *
+ * Allocating a swap slot under the global swap_lock for every page swapped
+ * out, and releasing it under swap_lock again when it is freed, makes the
+ * lock the limit on swap throughput to a fast device.  So each cpu keeps a
+ * batch of slots allocated in advance, refilled SWAP_SLOTS_BATCH at a time
+ * by get_swap_pages(); and a batch of freed slots, released together once
+ * SWAP_SLOTS_BATCH have built up.  A cpu refilling from the current cluster
+ * takes a sequence of slots from it, so its own writeout stays contiguous
+ * instead of being interleaved with that of the other cpus.
+ *
+ * A slot sitting in either cache has a swap_map of just SWAP_HAS_CACHE, but
+ * no page in swap cache: swap_slot_cached() tells read_swap_cache_async()
+ * not to wait for one.  Swapoff drains both caches of every cpu once it has
+ * cleared SWP_WRITEOK, after which no slot of that device can enter them.
+ */
+#define SWAP_SLOTS_BATCH	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_BATCH];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_BATCH];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/*
+ * Don't stock up the caches when swap is nearly full: the slots they hold
+ * would be unavailable to the other cpus.
+ */
+static inline int swap_slots_cache_worthwhile(void)
+{
+	return nr_swap_pages > num_online_cpus() * SWAP_SLOTS_BATCH * 2;
+}
+
+static void drain_swap_slots_cpu(int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	if (cache->nr) {
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->nr = 0;
+		cache->cur = 0;
+	}
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	spin_unlock(&cache->free_lock);
+}
+
+static void drain_swap_slots_cache(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_swap_slots_cpu(cpu);
 }
 
+/*
+ * Called, without swap_lock, on a slot whose last reference has gone:
+ * swap_entry_free() has left its swap_map as SWAP_HAS_CACHE meanwhile.
+ *
+ * The device learns that the slot's data is dead right here, not when the
+ * slot leaves the cache: zram frees its compressed copy on the notify.
+ */
+static void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_info_struct *p = &swap_info[swp_type(entry)];
+	struct swap_slots_cache *cache;
+
+	if (p->flags & SWP_BLKDEV) {
+		struct gendisk *disk = p->bdev->bd_disk;
+		if (disk->fops->swap_slot_free_notify)
+			disk->fops->swap_slot_free_notify(p->bdev,
+							  swp_offset(entry));
+	}
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	spin_lock(&cache->free_lock);
+	if (!(p->flags & SWP_WRITEOK)) {
+		/* Being swapped off: keep nothing of it cached */
+		swapcache_free_entries(&entry, 1);
+	} else {
+		if (cache->n_ret == SWAP_SLOTS_BATCH) {
+			swapcache_free_entries(cache->slots_ret,
+					       cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+	}
+	spin_unlock(&cache->free_lock);
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	if (cache->nr || swap_slots_cache_worthwhile()) {
+		/*
+		 * The mutex is held across the refill, which may sleep in
+		 * scan_swap_map(); if we migrate meanwhile, we just go on
+		 * using the cache of the cpu we started on.
+		 */
+		mutex_lock(&cache->alloc_lock);
+		if (!cache->nr && swap_slots_cache_worthwhile()) {
+			cache->nr = get_swap_pages(SWAP_SLOTS_BATCH,
+						   cache->slots);
+			cache->cur = 0;
+		}
+		if (cache->nr) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+/*
+ * Does a slot look like one waiting in a swap slots cache: no references,
+ * but SWAP_HAS_CACHE set on a device which is not being swapped off?
+ * Nobody can have such a slot's page to read in.
+ */
+int swap_slot_cached(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+	unsigned long offset = swp_offset(entry);
+	int ret = 0;
+
+	p = &swap_info[swp_type(entry)];
+	spin_lock(&swap_lock);
+	if ((p->flags & SWP_WRITEOK) && offset < p->max &&
+	    p->swap_map[offset] == SWAP_HAS_CACHE)
+		ret = 1;
+	spin_unlock(&swap_lock);
+	return ret;
+}
+
+static int swap_slots_cpu_notify(struct notifier_block *self,
+				 unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_swap_slots_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_notify, 0);
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
 /* The only caller of this function is now susupend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
@@ -575,17 +812,12 @@ static int swap_entry_free(struct swap_info_struct *p,
 	}
 	/* return code. */
 	count = p->swap_map[offset];
-	/* free if no reference */
-	if (!count) {
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
-			swap_list.next = p - swap_info;
-		nr_swap_pages++;
-		p->inuse_pages--;
-	}
+	/*
+	 * If no reference is left, the caller must free_swap_slot() after
+	 * dropping swap_lock: until then, keep others off the slot.
+	 */
+	if (!count)
+		p->swap_map[offset] = SWAP_HAS_CACHE;
 	if (!swap_count(count))
 		mem_cgroup_uncharge_swap(ent);
 	return count;
@@ -601,8 +833,11 @@ void swap_free(swp_entry_t entry)
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, SWAP_MAP);
+		int count = swap_entry_free(p, entry, SWAP_MAP);
+
 		spin_unlock(&swap_lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
@@ -626,6 +861,8 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 			mem_cgroup_uncharge_swapcache(page, entry, swapout);
 		}
 		spin_unlock(&swap_lock);
+		if (!ret)
+			free_swap_slot(entry);
 	}
 	return;
 }
@@ -704,7 +941,9 @@ int free_swap_and_cache(swp_entry_t entry)
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, SWAP_MAP) == SWAP_HAS_CACHE) {
+		int count = swap_entry_free(p, entry, SWAP_MAP);
+
+		if (count == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
@@ -712,6 +951,8 @@ int free_swap_and_cache(swp_entry_t entry)
 			}
 		}
 		spin_unlock(&swap_lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -896,7 +1137,7 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1574,6 +1815,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	/* No slot of p can enter the swap slots caches now: flush them */
+	drain_swap_slots_cache();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
@@ -1844,6 +2088,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (error < 0)
 			goto bad_swap;
 		p->bdev = bdev;
+		p->flags |= SWP_BLKDEV;
 	} else if (S_ISREG(inode->i_mode)) {
 		p->bdev = inode->i_sb->s_bdev;
 		mutex_lock(&inode->i_mutex);
@@ -2167,13 +2412,14 @@ get_swap_info_struct(unsigned type)
 }
 
 /*
+ * Find the readahead block of 1 << order entries around entry.
  * swap_lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
-int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
+int valid_swaphandles(swp_entry_t entry, int order, unsigned long *offset)
 {
 	struct swap_info_struct *si;
-	int our_page_cluster = page_cluster;
+	int our_page_cluster = order;
 	pgoff_t target, toff;
 	pgoff_t base, end;
 	int nr_pages = 0;
@@ -285,6 +285,36 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+/*
+ * Lookups walk the rbtree under RCU only: vmap_areas are freed by RCU,
+ * and __insert_vmap_area() links a node only once it is initialised.
+ * A rebalance running meanwhile can make the walk miss the area, or in
+ * theory visit nodes twice, so the walk is bounded and a miss is retried
+ * under vmap_area_lock.  A hit is always right, as only the owner of an
+ * area looks it up and nobody else can free it.
+ */
+#define VMAP_AREA_MAX_DEPTH	(2 * BITS_PER_LONG)
+
+static struct vmap_area *__find_vmap_area_rcu(unsigned long addr)
+{
+	struct rb_node *n = rcu_dereference(vmap_area_root.rb_node);
+	int depth = 0;
+
+	while (n && depth++ < VMAP_AREA_MAX_DEPTH) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = rcu_dereference(n->rb_left);
+		else if (addr > va->va_start)
+			n = rcu_dereference(n->rb_right);
+		else
+			return va;
+	}
+
+	return NULL;
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
@@ -304,6 +334,9 @@ static void __insert_vmap_area(struct vmap_area *va)
 			BUG();
 	}
 
+	/* Lockless walkers must not see the node before its contents */
+	va->rb_node.rb_left = va->rb_node.rb_right = NULL;
+	smp_wmb();
 	rb_link_node(&va->rb_node, parent, p);
 	rb_insert_color(&va->rb_node, &vmap_area_root);
 
@@ -507,13 +540,26 @@ static unsigned long lazy_max_pages(void)
 	return log * (32UL * 1024 * 1024 / PAGE_SIZE);
 }
 
-static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
+/*
+ * Lazily freed areas are queued on the freeing cpu, so that freeing only
+ * touches that cpu's queue rather than a global counter, and a purge
+ * finds them without walking all vmap areas.  Each cpu queues at most
+ * its share of lazy_max_pages() before purging all the queues at once.
+ */
+struct vmap_lazy_queue {
+	spinlock_t lock;
+	struct list_head list;		/* of vmap_areas, by purge_list */
+	unsigned long nr;		/* pages queued */
+};
+
+static DEFINE_PER_CPU(struct vmap_lazy_queue, vmap_lazy_queue);
 
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
 /*
- * Purges all lazily-freed vmap areas.
+ * Purges all lazily-freed vmap areas, with a single TLB flush covering
+ * all of them.
  *
  * If sync is 0 then don't purge if there is already a purge in progress.
  * If force_flush is 1, then flush kernel TLBs between *start and *end even
@@ -529,7 +575,8 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	LIST_HEAD(valist);
 	struct vmap_area *va;
 	struct vmap_area *n_va;
-	int nr = 0;
+	unsigned long nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -545,24 +592,27 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			unmap_vmap_area(va);
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	for_each_possible_cpu(cpu) {
+		struct vmap_lazy_queue *vlq = &per_cpu(vmap_lazy_queue, cpu);
+
+		if (list_empty(&vlq->list))
+			continue;
+		spin_lock(&vlq->lock);
+		list_splice_init(&vlq->list, &valist);
+		nr += vlq->nr;
+		vlq->nr = 0;
+		spin_unlock(&vlq->lock);
 	}
-	rcu_read_unlock();
 
-	if (nr)
-		atomic_sub(nr, &vmap_lazy_nr);
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		unmap_vmap_area(va);
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
+	}
 
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
@@ -603,9 +653,20 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_unmap_vmap_area_noflush(struct vmap_area *va)
 {
+	struct vmap_lazy_queue *vlq;
+	bool purge;
+
 	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+
+	vlq = &get_cpu_var(vmap_lazy_queue);
+	spin_lock(&vlq->lock);
+	list_add_tail(&va->purge_list, &vlq->list);
+	vlq->nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+	purge = vlq->nr > lazy_max_pages() / num_online_cpus();
+	spin_unlock(&vlq->lock);
+	put_cpu_var(vmap_lazy_queue);
+
+	if (unlikely(purge))
 		try_purge_vmap_area_lazy();
 }
 
@@ -622,6 +683,12 @@ static struct vmap_area *find_vmap_area(unsigned long addr)
 {
 	struct vmap_area *va;
 
+	rcu_read_lock();
+	va = __find_vmap_area_rcu(addr);
+	rcu_read_unlock();
+	if (likely(va))
+		return va;
+
 	spin_lock(&vmap_area_lock);
 	va = __find_vmap_area(addr);
 	spin_unlock(&vmap_area_lock);
@@ -1073,6 +1140,7 @@ EXPORT_SYMBOL(vm_map_ram);
 void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 {
 	static size_t vm_init_off __initdata;
+	struct vm_struct **p;
 	unsigned long addr;
 
 	addr = ALIGN(VMALLOC_START + vm_init_off, align);
@@ -1080,8 +1148,11 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 
 	vm->addr = (void *)addr;
 
-	vm->next = vmlist;
-	vmlist = vm;
+	/* Addresses only grow: appending keeps vmlist sorted */
+	for (p = &vmlist; *p; p = &(*p)->next)
+		;
+	vm->next = NULL;
+	*p = vm;
 }
 
 void __init vmalloc_init(void)
@@ -1093,9 +1164,15 @@ void __init vmalloc_init(void)
 	for_each_possible_cpu(i) {
 		struct vmap_block_queue *vbq;
 
+		struct vmap_lazy_queue *vlq;
+
 		vbq = &per_cpu(vmap_block_queue, i);
 		spin_lock_init(&vbq->lock);
 		INIT_LIST_HEAD(&vbq->free);
+
+		vlq = &per_cpu(vmap_lazy_queue, i);
+		spin_lock_init(&vlq->lock);
+		INIT_LIST_HEAD(&vlq->list);
 	}
 
 	/* Import existing vmlist entries. */
@@ -1104,6 +1181,7 @@ void __init vmalloc_init(void)
 		va->flags = tmp->flags | VM_VM_AREA;
 		va->va_start = (unsigned long)tmp->addr;
 		va->va_end = va->va_start + tmp->size;
+		va->private = tmp;
 		__insert_vmap_area(va);
 	}
 
@@ -1193,25 +1271,84 @@ EXPORT_SYMBOL_GPL(map_vm_area);
 DEFINE_RWLOCK(vmlist_lock);
 struct vm_struct *vmlist;
 
+/*
+ * vmlist holds, in address order, the vm_structs of exactly the vmap
+ * areas flagged VM_VM_AREA; the flag only changes under vmlist_lock.
+ * As vmap_area_list is in address order too, the vm_struct preceding an
+ * area's on vmlist is found from the area's neighbours, rather than by
+ * walking vmlist from its head.
+ *
+ * Called under vmlist_lock and vmap_area_lock.
+ */
+static struct vm_struct *vmlist_prev(struct vmap_area *va)
+{
+	list_for_each_entry_continue_reverse(va, &vmap_area_list, list) {
+		if (va->flags & VM_VM_AREA)
+			return va->private;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the first vm_struct on vmlist that ends above @addr.  Called
+ * under vmlist_lock, which keeps it there.
+ */
+static struct vm_struct *vmlist_find(unsigned long addr)
+{
+	struct vmap_area *va = NULL;
+	struct vm_struct *vm = NULL;
+	struct rb_node *n;
+
+	spin_lock(&vmap_area_lock);
+	n = vmap_area_root.rb_node;
+	while (n) {
+		struct vmap_area *tmp;
+
+		tmp = rb_entry(n, struct vmap_area, rb_node);
+		if (tmp->va_end > addr) {
+			va = tmp;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	if (va) {
+		list_for_each_entry_from(va, &vmap_area_list, list) {
+			if (va->flags & VM_VM_AREA) {
+				vm = va->private;
+				break;
+			}
+		}
+	}
+	spin_unlock(&vmap_area_lock);
+
+	return vm;
+}
+
 static void insert_vmalloc_vm(struct vm_struct *vm, struct vmap_area *va,
 			      unsigned long flags, void *caller)
 {
-	struct vm_struct *tmp, **p;
+	struct vm_struct *prev;
 
 	vm->flags = flags;
 	vm->addr = (void *)va->va_start;
 	vm->size = va->va_end - va->va_start;
 	vm->caller = caller;
 	va->private = vm;
-	va->flags |= VM_VM_AREA;
 
 	write_lock(&vmlist_lock);
-	for (p = &vmlist; (tmp = *p) != NULL; p = &tmp->next) {
-		if (tmp->addr >= vm->addr)
-			break;
+	spin_lock(&vmap_area_lock);
+	prev = vmlist_prev(va);
+	va->flags |= VM_VM_AREA;
+	spin_unlock(&vmap_area_lock);
+
+	if (prev) {
+		vm->next = prev->next;
+		prev->next = vm;
+	} else {
+		vm->next = vmlist;
+		vmlist = vm;
 	}
-	vm->next = *p;
-	*p = vm;
 	write_unlock(&vmlist_lock);
 }
 
@@ -1328,16 +1465,22 @@ struct vm_struct *remove_vm_area(const void *addr)
 	va = find_vmap_area((unsigned long)addr);
 	if (va && va->flags & VM_VM_AREA) {
 		struct vm_struct *vm = va->private;
-		struct vm_struct *tmp, **p;
+		struct vm_struct *prev;
 		/*
 		 * remove from list and disallow access to this vm_struct
 		 * before unmap. (address range confliction is maintained by
 		 * vmap.)
 		 */
 		write_lock(&vmlist_lock);
-		for (p = &vmlist; (tmp = *p) != vm; p = &tmp->next)
-			;
-		*p = tmp->next;
+		spin_lock(&vmap_area_lock);
+		prev = vmlist_prev(va);
+		va->flags &= ~VM_VM_AREA;
+		spin_unlock(&vmap_area_lock);
+
+		if (prev)
+			prev->next = vm->next;
+		else
+			vmlist = vm->next;
 		write_unlock(&vmlist_lock);
 
 		vmap_debug_free_range(va->va_start, va->va_end);
@@ -1827,7 +1970,8 @@ long vread(char *buf, char *addr, unsigned long count)
 		count = -(unsigned long) addr;
 
 	read_lock(&vmlist_lock);
-	for (tmp = vmlist; count && tmp; tmp = tmp->next) {
+	for (tmp = vmlist_find((unsigned long)addr); count && tmp;
+	     tmp = tmp->next) {
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
@@ -1905,7 +2049,8 @@ long vwrite(char *buf, char *addr, unsigned long count)
 	buflen = count;
 
 	read_lock(&vmlist_lock);
-	for (tmp = vmlist; count && tmp; tmp = tmp->next) {
+	for (tmp = vmlist_find((unsigned long)addr); count && tmp;
+	     tmp = tmp->next) {
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;